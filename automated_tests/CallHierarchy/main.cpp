@@ -0,0 +1,17 @@
+void leaf() {}
+
+void middle()
+{
+    leaf();
+}
+
+void top()
+{
+    middle();
+}
+
+int main()
+{
+    top();
+    return 0;
+}
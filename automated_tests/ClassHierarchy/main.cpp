@@ -0,0 +1,24 @@
+struct Base
+{
+    virtual ~Base() {}
+};
+
+struct Derived : public Base
+{
+};
+
+struct MoreDerived : public Derived
+{
+};
+
+struct Unrelated
+{
+};
+
+int main()
+{
+    MoreDerived d;
+    Unrelated u;
+    (void)u;
+    return 0;
+}
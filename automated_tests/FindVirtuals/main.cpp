@@ -0,0 +1,26 @@
+struct Base
+{
+    virtual ~Base() {}
+    virtual int value() const { return 0; }
+};
+
+struct Derived : public Base
+{
+    int value() const override { return 1; }
+};
+
+struct MoreDerived : public Derived
+{
+    int value() const override { return 2; }
+};
+
+struct Unrelated
+{
+    virtual int value() const { return 3; }
+};
+
+int main()
+{
+    MoreDerived d;
+    return d.value() + Unrelated().value();
+}
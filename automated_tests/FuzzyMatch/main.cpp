@@ -0,0 +1,8 @@
+int getSymbolName() { return 0; }
+int gasStationNumber() { return 1; }
+int unrelated() { return 2; }
+
+int main()
+{
+    return getSymbolName() + gasStationNumber() + unrelated();
+}
@@ -8,6 +8,7 @@
 # into the project folder.
 #
 import os
+import re
 import sys
 import json
 import subprocess as sp
@@ -25,9 +26,15 @@ def create_compile_commands(test_dir, test_files):
                               if src_file.endswith('.cpp'))]
 
 
+# Hierarchy output indents "name\tlocation" lines under titles, titles
+# have no location and are skipped.
+location_pattern = re.compile(r"([^\t:]+):(\d+):(\d+)")
+
+
 def read_locations(project_dir, lines):
-    lines = [line.split(":") for line in lines.split("\n") if len(line) > 0]
-    return [Location(os.path.join(project_dir, line[0]), line[1], line[2]) for line in lines]
+    matches = [location_pattern.search(line) for line in lines.split("\n") if len(line) > 0]
+    return [Location(os.path.join(project_dir, m.group(1)), m.group(2), m.group(3))
+            for m in matches if m]
 
 
 class Location:
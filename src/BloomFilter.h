@@ -0,0 +1,94 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef BloomFilter_h
+#define BloomFilter_h
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "rct/List.h"
+#include "rct/Serializer.h"
+
+/*
+ * Bloom filter over 64 bit hashes. Uses double hashing to derive the probes
+ * so callers only need to hash their keys once. A default constructed filter
+ * contains nothing.
+ */
+class BloomFilter
+{
+public:
+    BloomFilter()
+        : mProbes(0)
+    {}
+
+    BloomFilter(size_t count, size_t bitsPerKey = 10)
+        : mProbes(std::max<uint32_t>(1, std::min<uint32_t>(16, (bitsPerKey * 69) / 100))) // ln(2)
+    {
+        const size_t bits = std::max<size_t>(64, count * bitsPerKey);
+        mBits.resize((bits + 63) / 64, 0);
+    }
+
+    void insert(uint64_t hash)
+    {
+        assert(!mBits.isEmpty());
+        const uint64_t bits = mBits.size() * 64;
+        const uint64_t delta = (hash >> 33) | (hash << 31);
+        for (uint32_t i=0; i<mProbes; ++i) {
+            const uint64_t bit = hash % bits;
+            mBits[bit / 64] |= (1ull << (bit % 64));
+            hash += delta;
+        }
+    }
+
+    bool mightContain(uint64_t hash) const
+    {
+        if (mBits.isEmpty())
+            return false;
+        const uint64_t bits = mBits.size() * 64;
+        const uint64_t delta = (hash >> 33) | (hash << 31);
+        for (uint32_t i=0; i<mProbes; ++i) {
+            const uint64_t bit = hash % bits;
+            if (!(mBits[bit / 64] & (1ull << (bit % 64))))
+                return false;
+            hash += delta;
+        }
+        return true;
+    }
+
+    bool isEmpty() const { return mBits.isEmpty(); }
+    size_t memory() const { return sizeof(BloomFilter) + (mBits.size() * sizeof(uint64_t)); }
+
+    void encode(Serializer &s) const { s << mProbes << mBits; }
+    void decode(Deserializer &s) { s >> mProbes >> mBits; }
+private:
+    List<uint64_t> mBits;
+    uint32_t mProbes;
+};
+
+template <> inline Serializer &operator<<(Serializer &s, const BloomFilter &filter)
+{
+    filter.encode(s);
+    return s;
+}
+
+template <> inline Deserializer &operator>>(Deserializer &s, BloomFilter &filter)
+{
+    filter.decode(s);
+    return s;
+}
+
+#endif
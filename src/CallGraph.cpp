@@ -0,0 +1,182 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "CallGraph.h"
+
+#include <algorithm>
+
+#include "RTags.h"
+
+static_assert(sizeof(Location) == sizeof(uint64_t), "Edges are written as they are");
+
+void CallGraph::add(const FileMap<String, Set<Location> > &fileMap, List<Edge> &edges)
+{
+    const uint32_t count = fileMap.count();
+    FileMap<String, Set<Location> >::KeyCursor cursor;
+    for (uint32_t i=0; i<count; ++i) {
+        const FileMapString usr = fileMap.keyView(i, cursor);
+        const uint64_t hash = RTags::hashUsr(usr.data(), usr.size());
+        for (Location location : fileMap.valueAt(i))
+            edges.append({ hash, location });
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+}
+
+List<uint64_t> CallGraph::usrs(const File &file)
+{
+    List<uint64_t> ret;
+    for (const List<Edge> &edges : file.edges) {
+        for (const Edge &edge : edges) {
+            if (ret.isEmpty() || ret.last() != edge.usr)
+                ret.append(edge.usr);
+        }
+    }
+    std::sort(ret.begin(), ret.end());
+    ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+    return ret;
+}
+
+void CallGraph::addUsrs(uint32_t fileId, const File &file)
+{
+    for (uint64_t usr : usrs(file))
+        mUsrFiles[usr].append(fileId);
+}
+
+void CallGraph::insert(uint32_t fileId, const FileMap<String, Set<Location> > &callers, const FileMap<String, Set<Location> > &callees)
+{
+    remove(fileId);
+    File &file = mFiles[fileId];
+    add(callers, file.edges[Callers]);
+    add(callees, file.edges[Callees]);
+    addUsrs(fileId, file);
+}
+
+void CallGraph::remove(uint32_t fileId)
+{
+    const auto it = mFiles.find(fileId);
+    if (it == mFiles.end())
+        return;
+    for (uint64_t usr : usrs(it->second)) {
+        auto files = mUsrFiles.find(usr);
+        if (files == mUsrFiles.end())
+            continue;
+        List<uint32_t> &list = files->second;
+        list.erase(std::remove(list.begin(), list.end(), fileId), list.end());
+        if (list.isEmpty())
+            mUsrFiles.erase(files);
+    }
+    mFiles.erase(it);
+}
+
+void CallGraph::clear()
+{
+    mFiles.clear();
+    mUsrFiles.clear();
+}
+
+size_t CallGraph::memory() const
+{
+    size_t ret = sizeof(CallGraph) + (mFiles.size() * (sizeof(uint32_t) + sizeof(File)));
+    for (const auto &file : mFiles)
+        ret += (file.second.edges[Callers].size() + file.second.edges[Callees].size()) * sizeof(Edge);
+    for (const auto &files : mUsrFiles)
+        ret += sizeof(uint64_t) + sizeof(List<uint32_t>) + (files.second.size() * sizeof(uint32_t));
+    return ret;
+}
+
+Set<Location> CallGraph::find(Direction direction, uint64_t usr) const
+{
+    Set<Location> ret;
+    const auto files = mUsrFiles.find(usr);
+    if (files == mUsrFiles.end())
+        return ret;
+    for (uint32_t fileId : files->second) {
+        const auto file = mFiles.find(fileId);
+        if (file == mFiles.end())
+            continue;
+        const List<Edge> &edges = file->second.edges[direction];
+        auto it = std::lower_bound(edges.begin(), edges.end(), Edge { usr, Location() });
+        while (it != edges.end() && it->usr == usr) {
+            ret.insert(it->location);
+            ++it;
+        }
+    }
+    return ret;
+}
+
+void CallGraph::encode(Serializer &s) const
+{
+    s << static_cast<uint32_t>(Version) << static_cast<uint32_t>(mFiles.size());
+    for (const auto &file : mFiles) {
+        s << file.first;
+        for (const List<Edge> &edges : file.second.edges) {
+            s << static_cast<uint32_t>(edges.size());
+            if (!edges.isEmpty())
+                s.write(reinterpret_cast<const char *>(&edges[0]), edges.size() * sizeof(Edge));
+        }
+    }
+}
+
+bool CallGraph::decode(Deserializer &s, size_t size)
+{
+    clear();
+    // every count is checked against what's left so a damaged file fails
+    // instead of allocating whatever it says
+    size_t remaining = size;
+    auto consume = [&remaining](size_t bytes) {
+        if (bytes > remaining)
+            return false;
+        remaining -= bytes;
+        return true;
+    };
+    uint32_t version, count;
+    if (!consume(sizeof(uint32_t) * 2))
+        return false;
+    s >> version;
+    if (version != Version)
+        return false;
+    s >> count;
+    for (uint32_t i=0; i<count; ++i) {
+        if (!consume(sizeof(uint32_t))) {
+            clear();
+            return false;
+        }
+        uint32_t fileId;
+        s >> fileId;
+        File &file = mFiles[fileId];
+        for (List<Edge> &edges : file.edges) {
+            uint32_t edgeCount;
+            if (!consume(sizeof(uint32_t))) {
+                clear();
+                return false;
+            }
+            s >> edgeCount;
+            if (!consume(static_cast<size_t>(edgeCount) * sizeof(Edge))) {
+                clear();
+                return false;
+            }
+            edges.resize(edgeCount);
+            if (edgeCount)
+                s.read(reinterpret_cast<char *>(&edges[0]), edgeCount * sizeof(Edge));
+        }
+        addUsrs(fileId, file);
+    }
+    if (remaining) {
+        clear();
+        return false;
+    }
+    return true;
+}
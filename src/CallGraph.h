@@ -0,0 +1,95 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef CallGraph_h
+#define CallGraph_h
+
+#include "FileMap.h"
+#include "Location.h"
+#include "rct/Hash.h"
+#include "rct/List.h"
+#include "rct/Serializer.h"
+#include "rct/Set.h"
+#include "rct/String.h"
+
+/*
+ * Project wide call graph built from the callers and callees maps of all
+ * files, so caller queries don't have to open the targets map of every
+ * dependent file.
+ *
+ * There are a lot more calls than classes or overrides so the edges aren't
+ * kept in a hash of sets like the subclasses. Each file has its edges in
+ * sorted lists, 16 bytes per edge, and mUsrFiles knows which files have
+ * edges for a function. The edges of a file are replaced when it's indexed
+ * again.
+ */
+class CallGraph
+{
+public:
+    enum Direction {
+        Callers,
+        Callees
+    };
+
+    enum {
+        Version = 1
+    };
+
+    // the edges replace the ones the graph had for fileId
+    void insert(uint32_t fileId, const FileMap<String, Set<Location> > &callers, const FileMap<String, Set<Location> > &callees);
+    void remove(uint32_t fileId);
+    void clear();
+
+    bool contains(uint32_t fileId) const { return mFiles.contains(fileId); }
+    size_t fileCount() const { return mFiles.size(); }
+    size_t memory() const;
+
+    /*
+     * Definitions of the functions that call the function with the usr hash
+     * for Callers, declarations of the functions it calls for Callees.
+     */
+    Set<Location> find(Direction direction, uint64_t usr) const;
+
+    void encode(Serializer &s) const;
+    // size is the number of bytes encode() wrote, anything else fails
+    bool decode(Deserializer &s, size_t size);
+private:
+    struct Edge {
+        uint64_t usr;
+        Location location;
+
+        bool operator<(const Edge &other) const
+        {
+            return usr < other.usr || (usr == other.usr && location < other.location);
+        }
+        bool operator==(const Edge &other) const { return usr == other.usr && location == other.location; }
+    };
+
+    // the edges of a file for each Direction, sorted
+    struct File {
+        List<Edge> edges[2];
+    };
+
+    static void add(const FileMap<String, Set<Location> > &fileMap, List<Edge> &edges);
+    // the distinct usrs of the edges of file in both directions
+    static List<uint64_t> usrs(const File &file);
+    void addUsrs(uint32_t fileId, const File &file);
+
+    Hash<uint32_t, File> mFiles;
+    // usr hash -> the files with edges for it
+    Hash<uint64_t, List<uint32_t> > mUsrFiles;
+};
+
+#endif
@@ -0,0 +1,63 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "CallHierarchyJob.h"
+
+#include "Project.h"
+#include "RTags.h"
+
+CallHierarchyJob::CallHierarchyJob(Location loc,
+                                   const std::shared_ptr<QueryMessage> &query,
+                                   const std::shared_ptr<Project> &project)
+    : QueryJob(query, project), location(loc)
+{
+}
+
+int CallHierarchyJob::execute()
+{
+    Symbol symbol = project()->findSymbol(location);
+    if (symbol.isNull())
+        return 1;
+    if (!RTags::isFunction(symbol.kind))
+        symbol = project()->findTarget(symbol);
+    if (!RTags::isFunction(symbol.kind))
+        return 1;
+
+    const CallGraph::Direction direction = (queryFlags() & QueryMessage::CallHierarchyCallees
+                                            ? CallGraph::Callees : CallGraph::Callers);
+    const int depth = queryMessage()->depth();
+    // every function is expanded once, recursion and functions reached
+    // through more than one path are listed without their calls
+    Set<String> expanded;
+    std::function<bool(const Symbol &, int)> recurse = [&](const Symbol &sym, int level) -> bool {
+        if (!write<256>("%s%s\t%s",
+                        String(level * 2, ' ').constData(),
+                        sym.symbolName.constData(),
+                        sym.location.toString(locationToStringFlags()).constData())) {
+            return false;
+        }
+        if ((depth > 0 && level >= depth) || expanded.contains(sym.usr))
+            return true;
+        expanded.insert(sym.usr);
+        for (const Symbol &call : project()->findCalls(direction, sym)) {
+            if (!recurse(call, level + 1))
+                return false;
+        }
+        return true;
+    };
+    recurse(symbol, 0);
+    return 0;
+}
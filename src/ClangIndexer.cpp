@@ -16,6 +16,10 @@
 #define RTAGS_SINGLE_THREAD
 #include "ClangIndexer.h"
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 #include <unistd.h>
 #if CINDEX_VERSION >= CINDEX_VERSION_ENCODE(0, 25)
 #include <clang-c/Documentation.h>
@@ -23,6 +27,7 @@
 
 #include "Diagnostic.h"
 #include "FileMap.h"
+#include "FileMapContainer.h"
 #include "QueryMessage.h"
 #include "RClient.h"
 #include "rct/Connection.h"
@@ -30,6 +35,7 @@
 #include "rct/SHA256.h"
 #include "RTags.h"
 #include "RTagsVersion.h"
+#include "SymbolNameSuffixes.h"
 #include "VisitFileMessage.h"
 #include "VisitFileResponseMessage.h"
 #include "Location.h"
@@ -82,7 +88,7 @@ ClangIndexer::ClangIndexer()
       mVisitFileResponseMessageVisit(0), mParseDuration(0), mVisitDuration(0), mBlocked(0),
       mAllowed(0), mIndexed(1), mVisitFileTimeout(0), mIndexDataMessageTimeout(0),
       mFileIdsQueried(0), mFileIdsQueriedTime(0), mCursorsVisited(0), mLogFile(0),
-      mConnection(Connection::create(RClient::NumOptions)), mUnionRecursion(false),
+      mConnection(Connection::create(RClient::NumOptions)), mFileMapGeneration(0), mUnionRecursion(false),
       mInTemplateFunction(0)
 {
     mConnection->newMessage().connect(std::bind(&ClangIndexer::onMessage, this,
@@ -113,6 +119,7 @@ bool ClangIndexer::exec(const String &data)
 
     deserializer >> sServerSandboxRoot;
     deserializer >> id;
+    deserializer >> mFileMapGeneration;
     deserializer >> socketFile;
     deserializer >> mProject;
     uint32_t count;
@@ -206,6 +213,7 @@ bool ClangIndexer::exec(const String &data)
     mIndexDataMessage.setIndexerJobFlags(indexerJobFlags);
     mIndexDataMessage.setParseTime(parseTime);
     mIndexDataMessage.setId(id);
+    mIndexDataMessage.setFileMapGeneration(mFileMapGeneration);
 
     assert(mConnection->isConnected());
     assert(mSources.front().fileId);
@@ -244,14 +252,15 @@ bool ClangIndexer::exec(const String &data)
         String queryData;
         if (mFileIdsQueried)
             queryData = String::format(", %d queried %dms", mFileIdsQueried, mFileIdsQueriedTime);
-        const char *format = "(%d syms, %d symNames, %d includes, %d of %d files, symbols: %d of %d, %d cursors, %zu bytes written%s%s) (%d/%d/%dms)";
+        const char *format = "(%d syms, %d symNames, %d includes, %d of %d files, symbols: %d of %d, %d cursors, %zu bytes written%s%s) (%d/%d/%dms, encode %d write %dms)";
         message += String::format<1024>(format, cursorCount, symbolNameCount,
                                         mIndexDataMessage.includes().size(), mIndexed,
                                         mIndexDataMessage.files().size(), mAllowed,
                                         mAllowed + mBlocked, mCursorsVisited,
                                         mIndexDataMessage.bytesWritten(),
                                         queryData.constData(), mIndexDataMessage.flags() & IndexDataMessage::UsedPCH ? ", pch" : "",
-                                        mParseDuration, mVisitDuration, writeDuration);
+                                        mParseDuration, mVisitDuration, writeDuration,
+                                        mIndexDataMessage.encodeDuration(), mIndexDataMessage.writeDuration());
     }
     if (mIndexDataMessage.indexerJobFlags() & IndexerJob::Dirty) {
         message += " (dirty)";
@@ -294,6 +303,8 @@ void ClangIndexer::onMessage(const std::shared_ptr<Message> &msg, const std::sha
     const std::shared_ptr<VisitFileResponseMessage> vm = std::static_pointer_cast<VisitFileResponseMessage>(msg);
     mVisitFileResponseMessageVisit = vm->visit();
     mVisitFileResponseMessageFileId = vm->fileId();
+    if (vm->visit() && !vm->fileMapsDigest().isEmpty())
+        mFileMapsDigests[vm->fileId()] = std::make_pair(vm->fileMapGeneration(), vm->fileMapsDigest());
     assert(EventLoop::eventLoop());
     EventLoop::eventLoop()->quit();
 }
@@ -541,7 +552,7 @@ String ClangIndexer::addNamePermutations(const CXCursor &cursor, Location locati
         if (!trailer.isEmpty())
             ret += trailer;
         if (cursorType != RTags::Type_Reference) {
-            unit(location.fileId())->symbolNames[ret].insert(location);
+            unit(location.fileId())->symbolNames.insert(ret, location);
         }
     } else {
         ret.assign(buf + cutoff, std::max<int>(0, sizeof(buf) - cutoff - 1));
@@ -557,20 +568,30 @@ String ClangIndexer::addNamePermutations(const CXCursor &cursor, Location locati
                &colonColonCount, colonColons);
     assert((templateStart != -1) == (templateEnd != -1));
 
+    // Only the most qualified name (with and without the type) is stored,
+    // the less qualified ones are stored as suffixes of it.
+    StringLocationBuilder &symbolNames = unit(location.fileId())->symbolNames;
     // i == 0 --> with templates,
     // i == 1 without templates or without EnumConstantDecl part
     for (int i=0; i<2; ++i) {
+        String qualified, typeQualified;
+        int typeQualifiedStart = 0;
         for (int j=0; j<colonColonCount; ++j) {
             const char *ch = buf + colonColons[j];
             String name(ch, std::max<int>(0, sizeof(buf) - (ch - buf) - 1));
             if (name.isEmpty())
                 continue;
-            unit(location.fileId())->symbolNames[name].insert(location);
+            if (qualified.isEmpty()) {
+                qualified = name;
+                symbolNames.insert(qualified, location);
+            } else {
+                symbolNames.insertSuffix(qualified, 0, colonColons[j] - colonColons[0], location);
+            }
             if (originalKind == CXCursor_ObjCClassMethodDecl) {
                 const size_t idx = name.indexOf(':');
                 if (idx != String::npos && idx > 0) {
                     name.resize(idx);
-                    unit(location.fileId())->symbolNames[name].insert(location);
+                    symbolNames.insert(name, location);
                 }
             }
             if (!type.isEmpty() && (originalKind != CXCursor_ParmDecl || !strchr(ch, '('))) {
@@ -585,7 +606,17 @@ String ClangIndexer::addNamePermutations(const CXCursor &cursor, Location locati
                 // or
                 // void foo(int)::int bar
 
-                unit(location.fileId())->symbolNames[type + name].insert(location);
+                if (originalKind == CXCursor_ObjCClassMethodDecl) {
+                    // name might have lost its selector above
+                    symbolNames.insert(type + name, location);
+                } else if (typeQualified.isEmpty()) {
+                    typeQualified = type + name;
+                    typeQualifiedStart = colonColons[j];
+                    symbolNames.insert(typeQualified, location);
+                } else {
+                    symbolNames.insertSuffix(typeQualified, type.size(),
+                                             type.size() + (colonColons[j] - typeQualifiedStart), location);
+                }
             }
         }
 
@@ -1055,34 +1086,31 @@ bool ClangIndexer::handleReference(const CXCursor &cursor, CXCursorKind kind, Lo
     if (c->kind == CXCursor_MacroExpansion) {
         for (const auto &t : targets) {
             if (RTags::targetsValueKind(t.second) == CXCursor_MacroDefinition) {
-                for (const auto &u : mUnits) { // ### should only search the ones we depend on
-                    const auto it = u.second->usrs.find(t.first);
-                    if (it != u.second->usrs.end()) {
-                        auto mit = mMacroTokens.find(*it->second.begin());
-                        if (mit != mMacroTokens.end()) {
-                            const String id = RTags::eatString(clang_getCursorSpelling(cursor));
-                            auto idit = mit->second.data.find(id);
-                            if (idit != mit->second.data.end()) {
-                                List<Location> &locs = idit->second.locations;
-                                assert(!locs.isEmpty());
-                                location = locs.front();
-                                if (locs.size() == 1) {
-                                    if (mit->second.data.size() == 1) {
-                                        mMacroTokens.erase(mit);
-                                    } else {
-                                        mit->second.data.erase(idit);
-                                    }
+                const auto it = mMacroDefinitions.find(t.first);
+                if (it != mMacroDefinitions.end()) {
+                    auto mit = mMacroTokens.find(it->second);
+                    if (mit != mMacroTokens.end()) {
+                        const String id = RTags::eatString(clang_getCursorSpelling(cursor));
+                        auto idit = mit->second.data.find(id);
+                        if (idit != mit->second.data.end()) {
+                            List<Location> &locs = idit->second.locations;
+                            assert(!locs.isEmpty());
+                            location = locs.front();
+                            if (locs.size() == 1) {
+                                if (mit->second.data.size() == 1) {
+                                    mMacroTokens.erase(mit);
                                 } else {
-                                    locs.remove(0, 1);
+                                    mit->second.data.erase(idit);
                                 }
-                                std::shared_ptr<Unit> uu = unit(location);
-                                c = &uu->symbols[location];
-                                Map<String, uint16_t> &tt = uu->targets[location];
-                                tt[refUsr] = refTargetValue;
-                                setTarget = false;
+                            } else {
+                                locs.remove(0, 1);
                             }
+                            std::shared_ptr<Unit> uu = unit(location);
+                            c = &uu->symbols[location];
+                            Map<String, uint16_t> &tt = uu->targets[location];
+                            tt[refUsr] = refTargetValue;
+                            setTarget = false;
                         }
-                        break;
                     }
                 }
                 break;
@@ -1170,6 +1198,17 @@ bool ClangIndexer::handleReference(const CXCursor &cursor, CXCursorKind kind, Lo
     setType(*c, clang_getCursorType(kind == CXCursor_MemberRefExpr ? ref : cursor));
     if (RTags::isFunction(refKind)) {
         mLastCallExprSymbol = c;
+        for (int i=mScopeStack.size() - 1; i>=0; --i) {
+            const auto &scope = mScopeStack.at(i);
+            if (scope.type == Scope::FunctionDeclaration)
+                break;
+            if (scope.type == Scope::FunctionDefinition && !scope.symbol->usr.isEmpty()) {
+                auto u = unit(location);
+                u->callers.insert(refUsr, scope.symbol->location);
+                u->callees.insert(scope.symbol->usr, refLoc);
+                break;
+            }
+        }
     }
 
     if (mInTemplateFunction && !mParents.isEmpty()) {
@@ -1237,6 +1276,7 @@ std::unordered_set<CXCursor> ClangIndexer::addOverriddenCursors(const CXCursor &
 
                 // error() << location << "targets" << overridden[i];
                 unit(location)->targets[location][usr] = 0;
+                unit(location)->overrides.insert(usr, location);
                 process(overridden[i]);
             }
             clang_disposeOverriddenCursors(overridden);
@@ -1261,8 +1301,8 @@ void ClangIndexer::handleInclude(const CXCursor &cursor, CXCursorKind kind, Loca
             String include = "#include ";
             Path path = refLoc.path();
             assert(mSources.front().fileId);
-            unit(location)->symbolNames[(include + path)].insert(location);
-            unit(location)->symbolNames[(include + path.fileName())].insert(location);
+            unit(location)->symbolNames.insert(include + path, location);
+            unit(location)->symbolNames.insert(include + path.fileName(), location);
             mIndexDataMessage.includes().push_back(std::make_pair(location.fileId(), refLoc.fileId()));
             c.symbolName = "#include " + RTags::eatString(clang_getCursorDisplayName(cursor));
             c.kind = cursor.kind;
@@ -1315,7 +1355,7 @@ void ClangIndexer::handleLiteral(const CXCursor &cursor, CXCursorKind kind, Loca
         symbolName = RTags::eatString(clang_getCursorSpelling(cursor));
     }
     s.symbolName = symbolName;
-    u->symbolNames[symbolName].insert(location);
+    u->symbolNames.insert(symbolName, location);
     s.symbolLength = symbolName.size();
 }
 
@@ -1360,7 +1400,7 @@ CXChildVisitResult ClangIndexer::handleStatement(const CXCursor &cursor, CXCurso
             if (scope.type == Scope::FunctionDefinition) {
                 c.kind = kind;
                 c.symbolName = "return";
-                u->symbolNames[c.symbolName].insert(location);
+                u->symbolNames.insert(c.symbolName, location);
                 c.kind = kind;
                 c.symbolLength = 6;
                 c.location = location;
@@ -1390,7 +1430,7 @@ CXChildVisitResult ClangIndexer::handleStatement(const CXCursor &cursor, CXCurso
         case CXCursor_DoStmt: c.symbolName = "do"; break;
         default: assert(0); break;
         }
-        u->symbolNames[c.symbolName].insert(location);
+        u->symbolNames.insert(c.symbolName, location);
         c.symbolLength = c.symbolName.size();
         c.location = location;
         if (kind != CXCursor_IfStmt) {
@@ -1428,7 +1468,7 @@ CXChildVisitResult ClangIndexer::handleStatement(const CXCursor &cursor, CXCurso
         }
         setRange(c, clang_getCursorExtent(cursor));
         c.symbolName = kind == CXCursor_BreakStmt ? "break" : "continue";
-        u->symbolNames[c.symbolName].insert(location);
+        u->symbolNames.insert(c.symbolName, location);
         c.kind = kind;
         c.symbolLength = c.symbolName.size();
         c.location = location;
@@ -1468,6 +1508,7 @@ void ClangIndexer::handleBaseClassSpecifier(const CXCursor &cursor)
     }
     assert(!usr.isEmpty());
     lastClass.baseClasses << usr;
+    unit(mLastClass)->subclasses.insert(usr, mLastClass);
 }
 
 void ClangIndexer::extractArguments(List<Symbol::Argument> *arguments, const CXCursor &cursor)
@@ -1500,7 +1541,7 @@ CXChildVisitResult ClangIndexer::handleCursor(const CXCursor &cursor, CXCursorKi
     if (!c.isNull()) {
         if (c.kind == CXCursor_MacroExpansion) {
             addNamePermutations(cursor, location, RTags::Type_Cursor);
-            unit(location)->usrs[usr].insert(location);
+            unit(location)->usrs.insert(usr, location);
         }
         return CXChildVisit_Recurse;
     }
@@ -1648,6 +1689,7 @@ CXChildVisitResult ClangIndexer::handleCursor(const CXCursor &cursor, CXCursorKi
         CXToken *tokens = 0;
         unsigned numTokens = 0;
         clang_tokenize(tu, range, &tokens, &numTokens);
+        mMacroDefinitions[c.usr] = location;
         MacroData &macroData = mMacroTokens[location];
         enum {
             Unset,
@@ -1750,7 +1792,7 @@ CXChildVisitResult ClangIndexer::handleCursor(const CXCursor &cursor, CXCursorKi
     // their definition and their declaration.  Using the canonical
     // cursor's usr allows us to join them. Check JSClassRelease in
     // JavaScriptCore for an example.
-    unit(location)->usrs[c.usr].insert(location);
+    unit(location)->usrs.insert(c.usr, location);
     if (c.linkage == CXLinkage_External && !c.isDefinition()) {
         switch (c.kind) {
         case CXCursor_FunctionDecl:
@@ -2015,6 +2057,80 @@ static inline Map<String, Set<Location> > convertTargets(const Map<Location, Map
     return ret;
 }
 
+// Fills in the usr strings for all hashes in usrs and targets and returns the
+// hashes that are shared by more than one usr. Those are kept out of the
+// hashed maps in both so a hash always means the same usr within a file.
+static inline Set<uint64_t> usrNames(const StringLocationBuilder::Result &usrs,
+                                     const Map<String, Set<Location> > &targets,
+                                     Map<uint64_t, String> &names)
+{
+    Set<uint64_t> colliding;
+    auto add = [&names, &colliding](const String &usr) {
+        const uint64_t hash = RTags::hashUsr(usr);
+        auto it = names.find(hash);
+        if (it == names.end()) {
+            names[hash] = usr;
+        } else if (it->second != usr) {
+            colliding.insert(hash);
+        }
+    };
+    for (const auto &usr : usrs)
+        add(usr.first);
+    for (const auto &usr : targets)
+        add(usr.first);
+    for (uint64_t hash : colliding)
+        names.remove(hash);
+    return colliding;
+}
+
+// moves the values of in to hashed, sorted by hash, or to collisions
+template <typename Container, typename Value>
+static inline void hashUsrs(Container &in,
+                            const Set<uint64_t> &colliding,
+                            List<std::pair<uint64_t, Value> > &hashed,
+                            Map<String, Value> &collisions)
+{
+    hashed.reserve(in.size());
+    for (auto &usr : in) {
+        const uint64_t hash = RTags::hashUsr(usr.first);
+        if (colliding.contains(hash)) {
+            collisions[usr.first] = std::move(usr.second);
+        } else {
+            hashed.append(std::make_pair(hash, std::move(usr.second)));
+        }
+    }
+    std::sort(hashed.begin(), hashed.end(), [](const std::pair<uint64_t, Value> &l, const std::pair<uint64_t, Value> &r) {
+            return l.first < r.first;
+        });
+}
+
+// the values are the indexes of the usrs in the hashed targets map followed
+// by the target collisions, see Project::targetUsrAt()
+static inline Map<Location, Set<uint32_t> > reverseTargets(const Map<Location, Map<String, uint16_t> > &in,
+                                                          const List<std::pair<uint64_t, Set<Location> > > &targets,
+                                                          const Map<String, Set<Location> > &collisions,
+                                                          bool hasRoot)
+{
+    Hash<uint64_t, uint32_t> ids;
+    uint32_t id = 0;
+    for (const auto &target : targets)
+        ids[target.first] = id++;
+    Hash<String, uint32_t> collisionIds;
+    for (const auto &target : collisions)
+        collisionIds[target.first] = id++;
+
+    Map<Location, Set<uint32_t> > ret;
+    for (const auto &v : in) {
+        Set<uint32_t> &locationIds = ret[v.first];
+        for (const auto &u : v.second) {
+            const String usr = hasRoot ? Sandbox::encoded(u.first) : u.first;
+            auto it = collisionIds.find(usr);
+            locationIds.insert(it != collisionIds.end() ? it->second : ids.value(RTags::hashUsr(usr)));
+        }
+    }
+    return ret;
+}
+
 static inline void encodeSymbols(Map<Location, Symbol> &symbols)
 {
     assert(Sandbox::hasRoot());
@@ -2027,15 +2143,29 @@ static inline void encodeSymbols(Map<Location, Symbol> &symbols)
     }
 }
 
+static inline uint64_t elapsedUs(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
 bool ClangIndexer::writeFiles(const Path &root, String &error)
 {
-    size_t bytesWritten = 0;
+    const auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> bytesWritten(0);
+    // summed over the writer threads
+    std::atomic<uint64_t> encodeUs(0), writeUs(0);
+    std::mutex errorMutex, fileMapsMutex;
     const Path p = Sandbox::encoded(mSourceFile);
     const bool hasRoot = Sandbox::hasRoot();
     const uint32_t fileId = mSources.front().fileId;
 
+    // Runs on the writer threads. Each thread only modifies the unit it's
+    // writing, but the units share mStringPool and the Location file ids
+    // which are read from all threads. That's only safe as long as nothing
+    // is interned or inserted while writing, which is asserted below.
     auto process = [&](Hash<uint32_t, std::shared_ptr<Unit> >::const_iterator unit) {
         assert(mIndexDataMessage.files().value(unit->first) & IndexDataMessage::Visited);
+        auto phase = std::chrono::steady_clock::now();
         String unitRoot = root;
         unitRoot << unit->first;
         Path::mkdir(unitRoot, Path::Recursive);
@@ -2070,54 +2200,73 @@ bool ClangIndexer::writeFiles(const Path &root, String &error)
         //           << unit->second->targets.size()
         //           << unit->second->usrs.size()
         //           << unit->second->symbolNames.size();
-        uint32_t fileMapOpts = 0;
-        if (ClangIndexer::serverOpts() & Server::NoFileLock)
-            fileMapOpts |= FileMap<int, int>::NoLock;
-
-        if (hasRoot) {
+        writeUs += elapsedUs(phase);
+        phase = std::chrono::steady_clock::now();
+        if (hasRoot)
             encodeSymbols(unit->second->symbols);
-            Sandbox::encode(unit->second->usrs);
-            Sandbox::encode(unit->second->symbolNames);
-        }
-
-        size_t w;
-        // for (const char *name : { "/symbols", "/targets", "/usrs", "/symnames", "/tokens" }) {
-        //     if (Path::exists(unitRoot + "/symbols"))
-        //         ::error() << (unitRoot + name) << "already exists";
-        // }
-        if (!(w = FileMap<Location, Symbol>::write(unitRoot + "/symbols", unit->second->symbols, fileMapOpts))) {
-            error = "Failed to write symbols";
-            return false;
-        }
-        bytesWritten += w;
-
-        if (!(w = FileMap<String, Set<Location> >::write(unitRoot + "/targets", convertTargets(unit->second->targets, hasRoot), fileMapOpts))) {
-            error = "Failed to write targets";
-            return false;
-        }
-        bytesWritten += w;
-
-        if (!(w += FileMap<String, Set<Location> >::write(unitRoot + "/usrs", unit->second->usrs, fileMapOpts))) {
-            error = "Failed to write usrs";
-            return false;
-        }
-        bytesWritten += w;
-
-        if (!(w += FileMap<String, Set<Location> >::write(unitRoot + "/symnames", unit->second->symbolNames, fileMapOpts))) {
-            error = "Failed to write symbolNames";
-            return false;
+        // sandbox encodes the strings
+        StringLocationBuilder::Result usrs = unit->second->usrs.build();
+        List<SymbolNameSuffix> symbolNameSuffixes;
+        const StringLocationBuilder::Result symbolNames = unit->second->symbolNames.build(&symbolNameSuffixes);
+
+        // all maps go into one container so readers never see a mix of old
+        // and new maps for this file
+        List<FileMapContainer::Section> sections;
+        sections.reserve(14);
+        sections.append(FileMapContainer::Section(FileMapTypes::Symbols, FileMap<Location, Symbol>::encode(unit->second->symbols)));
+        Map<String, Set<Location> > targets = convertTargets(unit->second->targets, hasRoot);
+        Map<uint64_t, String> names;
+        const Set<uint64_t> colliding = usrNames(usrs, targets, names);
+        List<std::pair<uint64_t, Set<Location> > > hashedTargets;
+        List<std::pair<uint64_t, List<Location> > > hashedUsrs;
+        Map<String, Set<Location> > targetCollisions;
+        Map<String, List<Location> > usrCollisions;
+        hashUsrs(targets, colliding, hashedTargets, targetCollisions);
+        hashUsrs(usrs, colliding, hashedUsrs, usrCollisions);
+        sections.append(FileMapContainer::Section(FileMapTypes::Targets, FileMap<uint64_t, Set<Location> >::encode(hashedTargets)));
+        sections.append(FileMapContainer::Section(FileMapTypes::TargetCollisions, FileMap<String, Set<Location> >::encode(targetCollisions)));
+        sections.append(FileMapContainer::Section(FileMapTypes::ReverseTargets,
+                                                  FileMap<Location, Set<uint32_t> >::encode(reverseTargets(unit->second->targets, hashedTargets,
+                                                                                                           targetCollisions, hasRoot))));
+        sections.append(FileMapContainer::Section(FileMapTypes::Usrs, FileMap<uint64_t, Set<Location> >::encode(hashedUsrs)));
+        sections.append(FileMapContainer::Section(FileMapTypes::UsrCollisions, FileMap<String, Set<Location> >::encode(usrCollisions)));
+        sections.append(FileMapContainer::Section(FileMapTypes::UsrNames, FileMap<uint64_t, String>::encode(names)));
+        sections.append(FileMapContainer::Section(FileMapTypes::SymbolNames, FileMap<String, Set<Location> >::encode(symbolNames)));
+        sections.append(FileMapContainer::Section(FileMapTypes::SymbolSuffixes, SymbolNameSuffixes::encode(symbolNameSuffixes)));
+        sections.append(FileMapContainer::Section(FileMapTypes::Subclasses, FileMap<String, Set<Location> >::encode(unit->second->subclasses.build())));
+        sections.append(FileMapContainer::Section(FileMapTypes::Overrides, FileMap<String, Set<Location> >::encode(unit->second->overrides.build())));
+        sections.append(FileMapContainer::Section(FileMapTypes::Callers, FileMap<String, Set<Location> >::encode(unit->second->callers.build())));
+        sections.append(FileMapContainer::Section(FileMapTypes::Callees, FileMap<String, Set<Location> >::encode(unit->second->callees.build())));
+        sections.append(FileMapContainer::Section(FileMapTypes::Tokens, FileMap<uint32_t, Token>::encode(unit->second->tokens)));
+        const String digest = FileMapContainer::digest(sections);
+        encodeUs += elapsedUs(phase);
+
+        // nothing changed since the last time this file was indexed, rdm
+        // keeps using the generation it has
+        const auto existing = mFileMapsDigests.find(unit->first);
+        if (existing != mFileMapsDigests.end() && existing->second.second == digest) {
+            std::lock_guard<std::mutex> lock(fileMapsMutex);
+            mIndexDataMessage.unchangedFileMaps()[unit->first] = existing->second.first;
+            return true;
         }
-        bytesWritten += w;
 
-        if (!(w += FileMap<uint32_t, Token>::write(unitRoot + "/tokens", unit->second->tokens, fileMapOpts))) {
-            error = "Failed to write symbolNames";
+        phase = std::chrono::steady_clock::now();
+        const size_t w = FileMapContainer::write(unitRoot + "/" + FileMapTypes::fileMapsName(mFileMapGeneration), sections, digest);
+        writeUs += elapsedUs(phase);
+        if (!w) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            error = "Failed to write file maps";
             return false;
         }
         bytesWritten += w;
+        std::lock_guard<std::mutex> lock(fileMapsMutex);
+        mIndexDataMessage.fileMapDigests()[unit->first] = digest;
         return true;
     };
 
     List<std::shared_ptr<Unit> > templateSpecializationTargets;
+    List<Hash<uint32_t, std::shared_ptr<Unit> >::const_iterator> units;
+    units.reserve(mUnits.size());
     auto self = mUnits.end();
     for (auto it = mUnits.begin(); it != mUnits.end(); ++it) {
         if (!(mIndexDataMessage.files().value(it->first) & IndexDataMessage::Visited)) {
@@ -2133,8 +2282,8 @@ bool ClangIndexer::writeFiles(const Path &root, String &error)
         }
         if (it->first == fileId) {
             self = it;
-        } else if (!process(it)) {
-            return false;
+        } else {
+            units.append(it);
         }
     }
 
@@ -2142,10 +2291,35 @@ bool ClangIndexer::writeFiles(const Path &root, String &error)
         for (const std::shared_ptr<Unit> &t : templateSpecializationTargets) {
             self->second->targets.unite(t->targets);
         }
-        if (!process(self)) {
-            return false;
-        }
+        units.append(self);
     }
+
+    // translation units that claim a lot of headers spend as much time
+    // writing as parsing, so the units are written by a few threads
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    auto writer = [&]() {
+        size_t idx;
+        while (!failed && (idx = next++) < units.size()) {
+            if (!process(units.at(idx)))
+                failed = true;
+        }
+    };
+    const size_t threadCount = std::min<size_t>(units.size(), MaxWriteThreads);
+#ifndef NDEBUG
+    const size_t pooled = mStringPool.size();
+    const uint32_t lastFileId = Location::lastId();
+#endif
+    List<std::thread> threads;
+    for (size_t i=1; i<threadCount; ++i)
+        threads.emplace_back(writer);
+    writer();
+    for (std::thread &thread : threads)
+        thread.join();
+    assert(mStringPool.size() == pooled);
+    assert(Location::lastId() == lastFileId);
+    if (failed)
+        return false;
     String sourceRoot = root;
     sourceRoot << fileId;
     Path::mkdir(sourceRoot, Path::Recursive);
@@ -2164,6 +2338,7 @@ bool ClangIndexer::writeFiles(const Path &root, String &error)
 
     fclose(f);
     mIndexDataMessage.setBytesWritten(bytesWritten);
+    mIndexDataMessage.setWriteDurations(encodeUs / 1000, writeUs / 1000, elapsedUs(start) / 1000);
     return true;
 }
 
@@ -2201,21 +2376,20 @@ void ClangIndexer::tokenize(CXFile file, uint32_t fileId, const Path &path)
     CXSourceRange range = clang_getRange(startLoc, endLoc);
     CXToken *tokens = 0;
     unsigned numTokens = 0;
-    auto &map = unit(fileId)->tokens;
+    // the last translation unit that has the file wins
+    auto &list = unit(fileId)->tokens;
+    list.clear();
     clang_tokenize(tu, range, &tokens, &numTokens);
+    list.reserve(numTokens);
     for (unsigned i=0; i<numTokens; ++i) {
         range = clang_getTokenExtent(tu, tokens[i]);
         unsigned offset, endOffset;
-        const CXSourceLocation start = clang_getRangeStart(range);
-        clang_getSpellingLocation(start, 0, 0, 0, &offset);
+        clang_getSpellingLocation(clang_getRangeStart(range), 0, 0, 0, &offset);
         clang_getSpellingLocation(clang_getRangeEnd(range), 0, 0, 0, &endOffset);
-        map[offset] = {
-            clang_getTokenKind(tokens[i]),
-            RTags::eatString(clang_getTokenSpelling(tu, tokens[i])),
-            createLocation(start),
-            offset,
-            endOffset - offset
-        };
+        // clang_tokenize() returns the tokens in order
+        if (!list.isEmpty() && list.last().first >= offset)
+            continue;
+        list.append(std::make_pair(offset, Token(clang_getTokenKind(tokens[i]), offset, endOffset - offset)));
     }
 
     clang_disposeTokens(tu, tokens, numTokens);
@@ -2340,9 +2514,9 @@ void ClangIndexer::addFileSymbol(uint32_t file)
     const Location loc(file, 1, 1);
     const Path path = Location::path(file);
     auto ref = unit(loc);
-    ref->symbolNames[path].insert(loc);
+    ref->symbolNames.insert(path, loc);
     const char *fn = path.fileName();
-    ref->symbolNames[fn].insert(loc);
+    ref->symbolNames.insert(fn, loc);
     Symbol &sym = ref->symbols[loc];
     if (sym.isNull())
         sym.flags |= Symbol::FileSymbol;
@@ -25,6 +25,7 @@
 #include "rct/StopWatch.h"
 #include "RTags.h"
 #include "Server.h"
+#include "StringLocationBuilder.h"
 #include "Symbol.h"
 #include <unordered_set>
 
@@ -43,6 +44,8 @@ private:
     bool visit();
     bool parse();
     void tokenize(CXFile file, uint32_t fileId, const Path &path);
+    // the units are written by up to MaxWriteThreads threads
+    enum { MaxWriteThreads = 4 };
     bool writeFiles(const Path &root, String &error);
 
     void addFileSymbol(uint32_t file);
@@ -107,18 +110,31 @@ private:
     void onMessage(const std::shared_ptr<Message> &msg, const std::shared_ptr<Connection> &conn);
 
     struct Unit {
+        Unit(StringPool *pool)
+            : usrs(pool), symbolNames(pool), subclasses(pool), overrides(pool), callers(pool), callees(pool)
+        {}
+
         Map<Location, Symbol> symbols;
         Map<Location, Map<String, uint16_t> > targets;
-        Map<String, Set<Location> > usrs;
-        Map<String, Set<Location> > symbolNames;
-        Map<uint32_t, Token> tokens;
+        StringLocationBuilder usrs;
+        StringLocationBuilder symbolNames;
+        // base class usr -> the classes deriving from it
+        StringLocationBuilder subclasses;
+        // virtual method usr -> the methods overriding it, directly or not
+        StringLocationBuilder overrides;
+        // function usr -> the definitions of the functions calling it
+        StringLocationBuilder callers;
+        // function usr -> the functions its definition calls
+        StringLocationBuilder callees;
+        // sorted by offset
+        List<std::pair<uint32_t, Token> > tokens;
     };
 
     std::shared_ptr<Unit> &unit(uint32_t fileId)
     {
         std::shared_ptr<Unit> &unit = mUnits[fileId];
         if (!unit) {
-            unit.reset(new Unit);
+            unit.reset(new Unit(&mStringPool));
         }
         return unit;
     }
@@ -140,6 +156,10 @@ private:
         Map<String, MacroLocationData> data;
     };
     Map<Location, MacroData> mMacroTokens;
+    // macro usr -> location of its definition, the key in mMacroTokens
+    Hash<String, Location> mMacroDefinitions;
+    // usrs and symbol names of all units
+    StringPool mStringPool;
 
     Hash<uint32_t, std::shared_ptr<Unit> > mUnits;
 
@@ -164,6 +184,9 @@ private:
     FILE *mLogFile;
     std::shared_ptr<Connection> mConnection;
     Path mDataDir;
+    uint32_t mFileMapGeneration;
+    // fileId -> generation and digest of the file maps rdm has for it
+    Hash<uint32_t, std::pair<uint32_t, String> > mFileMapsDigests;
     bool mUnionRecursion;
 
     struct Scope {
@@ -17,12 +17,12 @@
 #define FileMap_h
 
 #include <assert.h>
-#include <fcntl.h>
-#include <sys/file.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
+#include <string.h>
+#include <strings.h>
 #include <functional>
 #include <limits>
+#include <memory>
+#include <type_traits>
 
 #include "Location.h"
 #include "rct/Serializer.h"
@@ -46,88 +46,307 @@ template <> inline int compare(const Location &l, const Location &r)
     return l.compare(r);
 }
 
-template <typename Key, typename Value>
-class FileMap
+/*
+ * Views of values serialized in a file map. They point straight into the
+ * mapped memory so scanning and comparing don't allocate. They are only valid
+ * for the lifetime of the FileMap they came from.
+ */
+class FileMapString
 {
 public:
-    FileMap()
-        : mPointer(0), mSize(0), mCount(0), mValuesOffset(0), mFD(-1), mOptions(0)
+    FileMapString()
+        : mData(0), mSize(0)
+    {}
+    FileMapString(const char *data, uint32_t size)
+        : mData(data), mSize(size)
     {}
 
-    ~FileMap()
+    const char *data() const { return mData; }
+    uint32_t size() const { return mSize; }
+    bool isEmpty() const { return !mSize; }
+
+    int compare(const String &other) const
     {
-        if (mFD != -1) {
-            assert(mPointer);
-            munmap(const_cast<char*>(mPointer), mSize);
-            if (!(mOptions & NoLock))
-                lock(mFD, Unlock);
-            int ret;
-            eintrwrap(ret, close(mFD));
-        }
+        const int cmp = memcmp(mData, other.constData(), std::min<size_t>(mSize, other.size()));
+        if (cmp)
+            return cmp;
+        if (mSize < other.size())
+            return -1;
+        return mSize > other.size() ? 1 : 0;
     }
 
-    void init(const char *pointer, uint32_t size)
+    bool startsWith(const String &str, String::CaseSensitivity cs = String::CaseSensitive) const
     {
-        mPointer = pointer;
-        mSize = size;
-        memcpy(&mCount, mPointer, sizeof(uint32_t));
-        memcpy(&mValuesOffset, mPointer + sizeof(uint32_t), sizeof(uint32_t));
+        if (str.size() > mSize)
+            return false;
+        if (cs == String::CaseInsensitive)
+            return !strncasecmp(mData, str.constData(), str.size());
+        return !memcmp(mData, str.constData(), str.size());
     }
 
-    enum Options {
-        None = 0x0,
-        NoLock = 0x1
+    bool operator==(const String &other) const { return mSize == other.size() && !compare(other); }
+    bool operator!=(const String &other) const { return !operator==(other); }
+
+    String toString() const { return String(mData, mSize); }
+private:
+    const char *mData;
+    uint32_t mSize;
+};
+
+inline int compare(const String &l, const FileMapString &r)
+{
+    return -r.compare(l);
+}
+
+class FileMapLocations
+{
+public:
+    FileMapLocations()
+        : mData(0), mSize(0)
+    {}
+    FileMapLocations(const char *data, uint32_t size)
+        : mData(data), mSize(size)
+    {}
+
+    class const_iterator
+    {
+    public:
+        const_iterator(const char *pos)
+            : mPos(pos)
+        {}
+        Location operator*() const
+        {
+            Location loc;
+            memcpy(&loc.value, mPos, sizeof(loc.value));
+            return loc;
+        }
+        const_iterator &operator++()
+        {
+            mPos += sizeof(uint64_t);
+            return *this;
+        }
+        bool operator==(const const_iterator &other) const { return mPos == other.mPos; }
+        bool operator!=(const const_iterator &other) const { return mPos != other.mPos; }
+    private:
+        const char *mPos;
     };
-    bool load(const Path &path, uint32_t options, String *error = 0)
+
+    uint32_t size() const { return mSize; }
+    bool isEmpty() const { return !mSize; }
+    const_iterator begin() const { return const_iterator(mData); }
+    const_iterator end() const { return const_iterator(mData + (mSize * sizeof(uint64_t))); }
+
+    Location at(uint32_t index) const
+    {
+        assert(index < mSize);
+        Location loc;
+        memcpy(&loc.value, mData + (index * sizeof(uint64_t)), sizeof(loc.value));
+        return loc;
+    }
+
+    // locations are serialized in Set order so this can binary search
+    bool contains(Location loc) const
     {
-        eintrwrap(mFD, open(path.constData(), O_RDONLY));
-        if (mFD == -1) {
-            if (error) {
-                *error = Rct::strerror();
-                *error << " " << __LINE__;
+        uint32_t lower = 0;
+        uint32_t upper = mSize;
+        while (lower < upper) {
+            const uint32_t mid = lower + ((upper - lower) / 2);
+            const int cmp = at(mid).compare(loc);
+            if (!cmp)
+                return true;
+            if (cmp < 0) {
+                lower = mid + 1;
+            } else {
+                upper = mid;
             }
-            return false;
         }
-        if (!(options & NoLock) && !lock(mFD, Read)) {
-            if (error) {
-                *error = Rct::strerror();
-                *error << " " << __LINE__;
-            }
+        return false;
+    }
 
-            close(mFD);
-            mFD = -1;
-            return false;
+    Set<Location> toSet() const
+    {
+        Set<Location> ret;
+        for (const Location loc : *this)
+            ret.insert(loc);
+        return ret;
+    }
+private:
+    const char *mData;
+    uint32_t mSize;
+};
+
+template <typename T> struct FileMapView
+{
+    typedef T Type;
+    static T read(const char *data)
+    {
+        Deserializer deserializer(data, INT_MAX);
+        T t;
+        deserializer >> t;
+        return t;
+    }
+};
+
+template <> struct FileMapView<String>
+{
+    typedef FileMapString Type;
+    static Type read(const char *data)
+    {
+        uint32_t size;
+        memcpy(&size, data, sizeof(size));
+        return Type(data + sizeof(size), size);
+    }
+};
+
+template <> struct FileMapView<Set<Location> >
+{
+    typedef FileMapLocations Type;
+    static Type read(const char *data)
+    {
+        uint32_t size;
+        memcpy(&size, data, sizeof(size));
+        return Type(data + sizeof(size), size);
+    }
+};
+
+/*
+ * String keys are front coded: every BlockSize'th key is a restart point that
+ * is stored in full and listed in a restart table, the keys in between only
+ * store the length of the prefix they share with the previous key and the
+ * remaining bytes. Lookups binary search the restart points and then decode a
+ * single block.
+ */
+template <typename T> struct FileMapFrontCoding
+{
+    enum { Enabled = 0 };
+    struct Cursor {};
+};
+
+template <> struct FileMapFrontCoding<String>
+{
+    enum { Enabled = 1, BlockSize = 16 };
+
+    /*
+     * The most recently decoded key of a map, lets sequential scans decode
+     * one entry at a time. Owned by the caller so the maps themselves have no
+     * mutable state and can be shared between readers.
+     */
+    struct Cursor
+    {
+        Cursor()
+            : index(std::numeric_limits<uint32_t>::max()), next(0), pointer(0)
+        {}
+
+        String key;
+        uint32_t index;
+        const char *next;
+        const char *pointer; // the map the key was decoded from
+    };
+
+    static void writeVarint(String &out, uint32_t value)
+    {
+        while (value >= 0x80) {
+            out.append(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
         }
+        out.append(static_cast<char>(value));
+    }
 
-        struct stat st;
-        if (fstat(mFD, &st)) {
-            if (error) {
-                *error = Rct::strerror();
-                *error << " " << __LINE__;
-            }
-            lock(mFD, Unlock);
-            int ret;
-            eintrwrap(ret, close(mFD));
-            mFD = -1;
+    static const char *readVarint(const char *data, uint32_t &value)
+    {
+        value = 0;
+        int shift = 0;
+        unsigned char byte;
+        do {
+            byte = static_cast<unsigned char>(*data++);
+            value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        return data;
+    }
+};
+
+/*
+ * Values can be stored column wise, a fixed size column with the fields that
+ * most lookups need followed by variable sized columns that are only
+ * deserialized when asked for. See FileMapColumns<Symbol> in Symbol.h.
+ */
+template <typename T> struct FileMapColumns
+{
+    enum { Enabled = 0 };
+};
+
+/*
+ * Keys that can be mapped to an integer with the same ordering as compare()
+ * get a cache friendly search index. Every SearchBlockSize'th key is stored
+ * as a fence in Eytzinger (BFS) order so that a lookup touches one cache line
+ * per level and then scans a single block of keys without branching.
+ */
+template <typename T> struct FileMapSearchKey
+{
+    enum { Enabled = 0 };
+    static uint64_t key(const T &) { return 0; }
+};
+
+template <> struct FileMapSearchKey<uint32_t>
+{
+    enum { Enabled = 1 };
+    static uint64_t key(uint32_t t) { return t; }
+};
+
+template <> struct FileMapSearchKey<uint64_t>
+{
+    enum { Enabled = 1 };
+    static uint64_t key(uint64_t t) { return t; }
+};
+
+template <> struct FileMapSearchKey<Location>
+{
+    enum { Enabled = 1 };
+    static uint64_t key(const Location &t) { return t.sortKey(); }
+};
+
+template <typename Key, typename Value>
+class FileMap
+{
+public:
+    FileMap()
+        : mPointer(0), mSize(0), mCount(0), mValuesOffset(0), mSearchOffset(0)
+    {}
+
+    enum {
+        Magic = 0x70614d46,
+        Version = 3,
+        HeaderSize = sizeof(uint32_t) * 5,
+        SearchBlockSize = 16,
+        SearchAlignment = 64
+    };
+
+    /*
+     * pointer needs to stay valid for the lifetime of the map, owner is kept
+     * alive until the map is destroyed. See FileMapContainer.
+     */
+    bool init(const char *pointer, uint32_t size, const std::shared_ptr<void> &owner = std::shared_ptr<void>(), String *error = 0)
+    {
+        uint32_t header[HeaderSize / sizeof(uint32_t)];
+        if (size < HeaderSize) {
+            if (error)
+                *error = "Truncated file map";
             return false;
         }
-
-        const char *pointer = static_cast<const char*>(mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, mFD, 0));
-        // error() << errno;//  << mPointer;
-        if (pointer == MAP_FAILED) {
-            if (error) {
-                *error = Rct::strerror();
-                *error << " " << __LINE__;
-            }
-            lock(mFD, Unlock);
-            int ret;
-            eintrwrap(ret, close(mFD));
-            mFD = -1;
+        memcpy(header, pointer, HeaderSize);
+        if (header[0] != Magic || header[1] != Version) {
+            if (error)
+                *error = String::format<64>("Wrong file map version %u, expected %u",
+                                            header[0] == Magic ? header[1] : 0, Version);
             return false;
         }
-
-        mOptions = options;
-        init(pointer, st.st_size);
+        mPointer = pointer;
+        mSize = size;
+        mCount = header[2];
+        mValuesOffset = header[3];
+        mSearchOffset = header[4];
+        mOwner = owner;
         return true;
     }
 
@@ -148,13 +367,48 @@ public:
     Key keyAt(uint32_t index) const
     {
         assert(index >= 0 && index < mCount);
-        return read<Key>(keysSegment(), index);
+        return keyAt(index, std::integral_constant<bool, FileMapFrontCoding<Key>::Enabled != 0>());
     }
 
     Value valueAt(uint32_t index) const
     {
         assert(index >= 0 && index < mCount);
-        return read<Value>(valuesSegment(), index);
+        return valueAt(index, std::numeric_limits<uint32_t>::max());
+    }
+
+    // for columnar values, only reads the columns in mask, see FileMapColumns
+    Value valueAt(uint32_t index, uint32_t columns) const
+    {
+        assert(index >= 0 && index < mCount);
+        return valueAt(index, columns, std::integral_constant<bool, FileMapColumns<Value>::Enabled != 0>());
+    }
+
+    typedef typename FileMapFrontCoding<Key>::Cursor KeyCursor;
+
+    // front coded keys have to be decoded into a KeyCursor, see below
+    typename FileMapView<Key>::Type keyView(uint32_t index) const
+    {
+        static_assert(!FileMapFrontCoding<Key>::Enabled, "Front coded keys need a KeyCursor");
+        assert(index >= 0 && index < mCount);
+        return view<Key>(keysSegment(), index);
+    }
+
+    /*
+     * For front coded keys the returned view points into cursor and is only
+     * valid until cursor is used again. Calls with increasing indexes only
+     * decode the entries in between.
+     */
+    typename FileMapView<Key>::Type keyView(uint32_t index, KeyCursor &cursor) const
+    {
+        assert(index >= 0 && index < mCount);
+        return decodeKey(index, cursor, std::integral_constant<bool, FileMapFrontCoding<Key>::Enabled != 0>());
+    }
+
+    typename FileMapView<Value>::Type valueView(uint32_t index) const
+    {
+        static_assert(!FileMapColumns<Value>::Enabled, "Use valueAt() with a column mask for columnar values");
+        assert(index >= 0 && index < mCount);
+        return view<Value>(valuesSegment(), index);
     }
 
     uint32_t lowerBound(const Key &k, bool *match = 0) const
@@ -165,12 +419,17 @@ public:
             return std::numeric_limits<uint32_t>::max();
 
         }
+        if (FileMapSearchKey<Key>::Enabled)
+            return searchLowerBound(FileMapSearchKey<Key>::key(k), match);
+        if (FileMapFrontCoding<Key>::Enabled)
+            return frontCodedLowerBound(k, match, std::integral_constant<bool, FileMapFrontCoding<Key>::Enabled != 0>());
+        KeyCursor cursor;
         int lower = 0;
         int upper = mCount - 1;
 
         do {
             const int mid = lower + ((upper - lower) / 2);
-            const int cmp = compare<Key>(k, keyAt(mid));
+            const int cmp = compare(k, keyView(mid, cursor));
             if (cmp < 0) {
                 upper = mid - 1;
             } else if (cmp > 0) {
@@ -189,103 +448,344 @@ public:
         return lower;
     }
 
-    static String encode(const Map<Key, Value> &map)
+    /*
+     * lowerBound() for each of the count keys, which have to be sorted.
+     * Every search gallops forward from where the previous one ended so
+     * resolving many keys walks the map once instead of doing a full binary
+     * search per key. matches may be null.
+     */
+    void lowerBounds(const Key *keys, uint32_t count, uint32_t *indexes, bool *matches) const
+    {
+        KeyCursor cursor;
+        uint32_t lower = 0;
+        for (uint32_t i=0; i<count; ++i) {
+            const Key &k = keys[i];
+            assert(!i || compare(keys[i - 1], k) <= 0);
+            uint32_t upper = lower;
+            uint32_t step = 1;
+            while (upper < mCount && compareAt(k, upper, cursor) > 0) {
+                lower = upper + 1;
+                upper = lower + step;
+                step *= 2;
+            }
+            upper = std::min(upper, mCount);
+            while (lower < upper) {
+                const uint32_t mid = lower + ((upper - lower) / 2);
+                if (compareAt(k, mid, cursor) > 0) {
+                    lower = mid + 1;
+                } else {
+                    upper = mid;
+                }
+            }
+            const bool match = lower < mCount && !compareAt(k, lower, cursor);
+            if (matches)
+                matches[i] = match;
+            indexes[i] = lower == mCount ? std::numeric_limits<uint32_t>::max() : lower;
+        }
+    }
+
+    // map can be any container of key/value pairs sorted by key without
+    // duplicates, e.g. a Map or a List of pairs
+    template <typename Container>
+    static String encode(const Container &map)
     {
         String out;
         Serializer serializer(out);
-        serializer << static_cast<uint32_t>(map.size());
+        serializer << static_cast<uint32_t>(Magic) << static_cast<uint32_t>(Version)
+                   << static_cast<uint32_t>(map.size());
         uint32_t valuesOffset;
         if (uint32_t size = FixedSize<Key>::value) {
-            valuesOffset = ((static_cast<uint32_t>(map.size()) * size) + (sizeof(uint32_t) * 2));
-            serializer << valuesOffset;
-            for (const std::pair<Key, Value> &pair : map) {
+            valuesOffset = ((static_cast<uint32_t>(map.size()) * size) + HeaderSize);
+            serializer << valuesOffset << static_cast<uint32_t>(0);
+            for (const auto &pair : map) {
                 out.append(reinterpret_cast<const char*>(&pair.first), size);
             }
+        } else if (FileMapFrontCoding<Key>::Enabled) {
+            serializer << static_cast<uint32_t>(0) << static_cast<uint32_t>(0); // values offset, search offset
+            encodeFrontCodedKeys(map, out, std::integral_constant<bool, FileMapFrontCoding<Key>::Enabled != 0>());
+            valuesOffset = out.size();
+            memcpy(out.data() + (sizeof(uint32_t) * 3), &valuesOffset, sizeof(valuesOffset));
         } else {
-            serializer << static_cast<uint32_t>(0); // values offset
-            uint32_t offset = sizeof(uint32_t) * 2 + (map.size() * sizeof(uint32_t));
-            String keyData;
-            Serializer keySerializer(keyData);
-            for (const std::pair<Key, Value> &pair : map) {
-                const uint32_t pos = offset + keyData.size();
-                out.append(reinterpret_cast<const char*>(&pos), sizeof(pos));
-                keySerializer << pair.first;
+            // the keys are serialized straight after their offset table
+            serializer << static_cast<uint32_t>(0) << static_cast<uint32_t>(0); // values offset, search offset
+            const uint32_t tableOffset = out.size();
+            out.resize(tableOffset + (map.size() * sizeof(uint32_t)));
+            uint32_t idx = 0;
+            for (const auto &pair : map) {
+                const uint32_t pos = out.size();
+                memcpy(out.data() + tableOffset + (idx++ * sizeof(uint32_t)), &pos, sizeof(pos));
+                serializer << pair.first;
             }
-            out.append(keyData);
             valuesOffset = out.size();
-            memcpy(out.data() + sizeof(uint32_t), &valuesOffset, sizeof(valuesOffset));
+            memcpy(out.data() + (sizeof(uint32_t) * 3), &valuesOffset, sizeof(valuesOffset));
         }
         assert(valuesOffset == static_cast<uint32_t>(out.size()));
 
-        if (uint32_t size = FixedSize<Value>::value) {
-            for (const std::pair<Key, Value> &pair : map) {
+        if (FileMapColumns<Value>::Enabled) {
+            encodeColumns(map, out, std::integral_constant<bool, FileMapColumns<Value>::Enabled != 0>());
+        } else if (uint32_t size = FixedSize<Value>::value) {
+            for (const auto &pair : map) {
                 out.append(reinterpret_cast<const char*>(&pair.second), size);
             }
         } else {
-            const uint32_t encodedValuesOffset = valuesOffset + (sizeof(uint32_t) * map.size());
-            String valueData;
-            Serializer valueSerializer(valueData);
-            for (const std::pair<Key, Value> &pair : map) {
-                const uint32_t pos = encodedValuesOffset + valueData.size();
-                out.append(reinterpret_cast<const char*>(&pos), sizeof(pos));
-                valueSerializer << pair.second;
+            out.resize(valuesOffset + (map.size() * sizeof(uint32_t)));
+            uint32_t idx = 0;
+            for (const auto &pair : map) {
+                const uint32_t pos = out.size();
+                memcpy(out.data() + valuesOffset + (idx++ * sizeof(uint32_t)), &pos, sizeof(pos));
+                serializer << pair.second;
             }
-            out.append(valueData);
-
         }
+        if (FileMapSearchKey<Key>::Enabled && map.size() > SearchBlockSize)
+            encodeSearchIndex(map, out);
         return out;
     }
-    static size_t write(const Path &path, const Map<Key, Value> &map, uint32_t options)
+private:
+    const char *valuesSegment() const { return mPointer + mValuesOffset; }
+    const char *keysSegment() const { return mPointer + HeaderSize; }
+
+    int compareAt(const Key &k, uint32_t index, KeyCursor &cursor) const
+    {
+        if (FileMapSearchKey<Key>::Enabled)
+            return compare(FileMapSearchKey<Key>::key(k), searchKeyAt(index));
+        return compareAt(k, index, cursor, std::integral_constant<bool, FileMapFrontCoding<Key>::Enabled != 0>());
+    }
+
+    int compareAt(const Key &k, uint32_t index, KeyCursor &cursor, std::false_type) const
+    {
+        return compare(k, keyView(index, cursor));
+    }
+
+    int compareAt(const Key &k, uint32_t index, KeyCursor &cursor, std::true_type) const
+    {
+        return -keyView(index, cursor).compare(k);
+    }
+
+    Key keyAt(uint32_t index, std::false_type) const
+    {
+        return read<Key>(keysSegment(), index);
+    }
+
+    Key keyAt(uint32_t index, std::true_type) const
+    {
+        KeyCursor cursor;
+        return keyView(index, cursor).toString();
+    }
+
+    typename FileMapView<Key>::Type decodeKey(uint32_t index, KeyCursor &, std::false_type) const
     {
-        int fd = open(path.constData(), O_RDWR|O_CREAT, 0644);
-        if (fd == -1) {
-            if (!Path::mkdir(path.parentDir(), Path::Recursive))
-                return 0;
-            fd = open(path.constData(), O_RDWR|O_CREAT, 0644);
-            if (fd == -1)
-                return 0;
+        return view<Key>(keysSegment(), index);
+    }
+
+    Value valueAt(uint32_t index, uint32_t, std::false_type) const
+    {
+        return read<Value>(valuesSegment(), index);
+    }
+
+    Value valueAt(uint32_t index, uint32_t columns, std::true_type) const
+    {
+        Value value;
+        FileMapColumns<Value>::decode(value, mPointer, valuesSegment(), mCount, index, columns);
+        FileMapColumns<Value>::setKey(value, keyAt(index));
+        return value;
+    }
+
+    template <typename Container>
+    static void encodeColumns(const Container &, String &, std::false_type)
+    {
+    }
+
+    template <typename Container>
+    static void encodeColumns(const Container &map, String &out, std::true_type)
+    {
+        FileMapColumns<Value>::encode(map, out);
+    }
+
+    typedef FileMapFrontCoding<Key> FrontCoding;
+
+    FileMapString restartKey(uint32_t restart) const
+    {
+        uint32_t offset;
+        memcpy(&offset, keysSegment() + (restart * sizeof(uint32_t)), sizeof(offset));
+        uint32_t shared, size;
+        const char *data = FrontCoding::readVarint(mPointer + offset, shared);
+        assert(!shared);
+        data = FrontCoding::readVarint(data, size);
+        return FileMapString(data, size);
+    }
+
+    FileMapString decodeKey(uint32_t index, KeyCursor &cursor, std::true_type) const
+    {
+        const uint32_t restart = index / FrontCoding::BlockSize;
+        if (cursor.pointer != mPointer || cursor.index > index || cursor.index / FrontCoding::BlockSize != restart) {
+            uint32_t offset;
+            memcpy(&offset, keysSegment() + (restart * sizeof(uint32_t)), sizeof(offset));
+            cursor.index = (restart * FrontCoding::BlockSize) - 1;
+            cursor.next = mPointer + offset;
+            cursor.pointer = mPointer;
         }
-        if (!(options & NoLock) && !lock(fd, Write)) {
-            ::close(fd);
-            return 0;
+        while (cursor.index != index) {
+            uint32_t shared, size;
+            const char *data = FrontCoding::readVarint(cursor.next, shared);
+            data = FrontCoding::readVarint(data, size);
+            cursor.key.resize(shared);
+            cursor.key.append(data, size);
+            cursor.next = data + size;
+            ++cursor.index;
         }
-        const String data = encode(map);
-        bool ok = ::ftruncate(fd, data.size()) != -1;
-        if (!ok) {
-            if (!(options & NoLock))
-                lock(fd, Unlock);
-            ::close(fd);
+        return FileMapString(cursor.key.constData(), cursor.key.size());
+    }
+
+    uint32_t frontCodedLowerBound(const Key &, bool *, std::false_type) const
+    {
+        return std::numeric_limits<uint32_t>::max();
+    }
+
+    uint32_t frontCodedLowerBound(const Key &k, bool *match, std::true_type) const
+    {
+        // find the last restart point that is <= k
+        uint32_t lower = 0;
+        uint32_t upper = (mCount + FrontCoding::BlockSize - 1) / FrontCoding::BlockSize;
+        while (lower < upper) {
+            const uint32_t mid = lower + ((upper - lower) / 2);
+            if (restartKey(mid).compare(k) <= 0) {
+                lower = mid + 1;
+            } else {
+                upper = mid;
+            }
+        }
+        if (match)
+            *match = false;
+        if (!lower)
             return 0;
+        const uint32_t start = (lower - 1) * FrontCoding::BlockSize;
+        const uint32_t end = std::min<uint32_t>(start + FrontCoding::BlockSize, mCount);
+        KeyCursor cursor;
+        for (uint32_t i=start; i<end; ++i) {
+            const int cmp = keyView(i, cursor).compare(k);
+            if (cmp >= 0) {
+                if (match)
+                    *match = !cmp;
+                return i;
+            }
         }
+        return end == mCount ? std::numeric_limits<uint32_t>::max() : end;
+    }
 
-        ok = ::write(fd, data.constData(), data.size()) == static_cast<ssize_t>(data.size());
-        if (!(options & NoLock))
-            ok = lock(fd, Unlock) && ok;
+    template <typename Container>
+    static void encodeFrontCodedKeys(const Container &, String &, std::false_type)
+    {
+    }
 
-        ::close(fd);
-        if (!ok)
-            unlink(path.constData());
-        return ok ? data.size() : 0;
+    template <typename Container>
+    static void encodeFrontCodedKeys(const Container &map, String &out, std::true_type)
+    {
+        const uint32_t restarts = (map.size() + FrontCoding::BlockSize - 1) / FrontCoding::BlockSize;
+        const uint32_t restartsOffset = out.size();
+        out.resize(restartsOffset + (restarts * sizeof(uint32_t)));
+        uint32_t idx = 0;
+        const String *previous = 0;
+        for (const auto &pair : map) {
+            const String &key = pair.first;
+            uint32_t shared = 0;
+            if (idx % FrontCoding::BlockSize) {
+                const uint32_t max = std::min<uint32_t>(previous->size(), key.size());
+                while (shared < max && previous->at(shared) == key.at(shared))
+                    ++shared;
+            } else {
+                const uint32_t pos = out.size();
+                memcpy(out.data() + restartsOffset + ((idx / FrontCoding::BlockSize) * sizeof(uint32_t)), &pos, sizeof(pos));
+            }
+            FrontCoding::writeVarint(out, shared);
+            FrontCoding::writeVarint(out, key.size() - shared);
+            out.append(key.constData() + shared, key.size() - shared);
+            previous = &key;
+            ++idx;
+        }
     }
-private:
-    enum Mode {
-        Read = F_RDLCK,
-        Write = F_WRLCK,
-        Unlock = F_UNLCK
-    };
-    static bool lock(int fd, Mode mode)
+
+    static uint32_t fenceCount(uint32_t count) { return ((count + SearchBlockSize - 1) / SearchBlockSize) - 1; }
+
+    // Fences are the first keys of every block but the first, laid out in
+    // Eytzinger order at slots 1..fences. A parallel array maps each slot
+    // back to its sorted rank. Both start at a cache line boundary.
+    template <typename Container>
+    static void encodeSearchIndex(const Container &map, String &out)
     {
-        struct flock fl;
-        memset(&fl, 0, sizeof(fl));
-        fl.l_type = mode;
-        fl.l_whence = SEEK_SET;
-        fl.l_pid = getpid();
-        int ret;
-        eintrwrap(ret, fcntl(fd, F_SETLKW, &fl));
-        return ret != -1;
+        const uint32_t count = map.size();
+        const uint32_t fences = fenceCount(count);
+        List<uint64_t> sorted;
+        sorted.reserve(fences);
+        uint32_t idx = 0;
+        for (const auto &pair : map) {
+            if (idx && !(idx % SearchBlockSize))
+                sorted.append(FileMapSearchKey<Key>::key(pair.first));
+            ++idx;
+        }
+        assert(sorted.size() == fences);
+
+        List<uint64_t> eytzinger(fences + 1, 0);
+        List<uint32_t> ranks(fences + 1, 0);
+        uint32_t rank = 0;
+        std::function<void(uint32_t)> build = [&](uint32_t k) {
+            if (k <= fences) {
+                build(2 * k);
+                ranks[k] = rank;
+                eytzinger[k] = sorted[rank++];
+                build(2 * k + 1);
+            }
+        };
+        build(1);
+
+        const uint32_t searchOffset = ((out.size() + SearchAlignment - 1) / SearchAlignment) * SearchAlignment;
+        out.resize(searchOffset);
+        memcpy(out.data() + (sizeof(uint32_t) * 4), &searchOffset, sizeof(searchOffset));
+        out.append(reinterpret_cast<const char*>(eytzinger.data()), eytzinger.size() * sizeof(uint64_t));
+        out.append(reinterpret_cast<const char*>(ranks.data()), ranks.size() * sizeof(uint32_t));
+    }
+
+    inline uint64_t searchKeyAt(uint32_t index) const
+    {
+        Key key;
+        memcpy(&key, keysSegment() + (index * FixedSize<Key>::value), FixedSize<Key>::value);
+        return FileMapSearchKey<Key>::key(key);
+    }
+
+    uint32_t searchLowerBound(uint64_t key, bool *match) const
+    {
+        uint32_t block = 0;
+        if (mSearchOffset) {
+            const uint32_t fences = fenceCount(mCount);
+            const char *eytzinger = mPointer + mSearchOffset;
+            uint32_t k = 1;
+            while (k <= fences) {
+                __builtin_prefetch(eytzinger + (k * SearchAlignment));
+                uint64_t fence;
+                memcpy(&fence, eytzinger + (k * sizeof(uint64_t)), sizeof(fence));
+                k = (2 * k) + (fence < key);
+            }
+            k >>= __builtin_ffs(~static_cast<int>(k));
+            if (k) {
+                memcpy(&block, eytzinger + ((fences + 1) * sizeof(uint64_t)) + (k * sizeof(uint32_t)), sizeof(block));
+            } else {
+                block = fences;
+            }
+        }
+        const uint32_t start = block * SearchBlockSize;
+        const uint32_t end = std::min<uint32_t>(start + SearchBlockSize, mCount);
+        uint32_t idx = start;
+        for (uint32_t i=start; i<end; ++i)
+            idx += searchKeyAt(i) < key;
+
+        if (idx == mCount) {
+            if (match)
+                *match = false;
+            return std::numeric_limits<uint32_t>::max();
+        }
+        if (match)
+            *match = searchKeyAt(idx) == key;
+        return idx;
     }
-    const char *valuesSegment() const { return mPointer + mValuesOffset; }
-    const char *keysSegment() const { return mPointer + (sizeof(uint32_t) * 2); }
 
     template <typename T>
     inline T read(const char *base, uint32_t index) const
@@ -303,12 +803,32 @@ private:
         return t;
     }
 
+    template <typename T>
+    inline typename FileMapView<T>::Type view(const char *base, uint32_t index) const
+    {
+        return view<T>(base, index, std::integral_constant<bool, FixedSize<T>::value != 0>());
+    }
+
+    template <typename T>
+    inline T view(const char *base, uint32_t index, std::true_type) const
+    {
+        return read<T>(base, index);
+    }
+
+    template <typename T>
+    inline typename FileMapView<T>::Type view(const char *base, uint32_t index, std::false_type) const
+    {
+        uint32_t offset;
+        memcpy(&offset, base + (sizeof(uint32_t) * index), sizeof(offset));
+        return FileMapView<T>::read(mPointer + offset);
+    }
+
     const char *mPointer;
     uint32_t mSize;
     uint32_t mCount;
     uint32_t mValuesOffset;
-    int mFD;
-    uint32_t mOptions;
+    uint32_t mSearchOffset;
+    std::shared_ptr<void> mOwner;
 };
 
 #endif
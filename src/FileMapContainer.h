@@ -0,0 +1,344 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef FileMapContainer_h
+#define FileMapContainer_h
+
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <memory>
+
+#include "FileMap.h"
+#include "rct/Hash.h"
+#include "rct/List.h"
+#include "rct/Path.h"
+#include "rct/Rct.h"
+#include "rct/SHA256.h"
+#include "rct/String.h"
+
+/*
+ * The sections of a container. rp writes them and rdm reads them so they
+ * live here rather than in Project, which inherits them.
+ */
+struct FileMapTypes
+{
+    enum FileMapType {
+        Symbols,
+        SymbolNames,
+        Targets,
+        Usrs,
+        Tokens,
+        ReverseTargets,
+        UsrCollisions,
+        TargetCollisions,
+        UsrNames,
+        SymbolSuffixes,
+        Subclasses,
+        Overrides,
+        Callers,
+        Callees
+    };
+    static const char *fileMapName(FileMapType type)
+    {
+        switch (type) {
+        case Symbols: return "symbols";
+        case SymbolNames: return "symnames";
+        case Targets: return "targets";
+        case Usrs: return "usrs";
+        case Tokens: return "tokens";
+        case ReverseTargets: return "rtargets";
+        case UsrCollisions: return "usrcollisions";
+        case TargetCollisions: return "targetcollisions";
+        case UsrNames: return "usrnames";
+        case SymbolSuffixes: return "symsuffixes";
+        case Subclasses: return "subclasses";
+        case Overrides: return "overrides";
+        case Callers: return "callers";
+        case Callees: return "callees";
+        }
+        return 0;
+    }
+    // all file maps of a source file live in one container. Every indexing
+    // run writes a new generation.
+    static String fileMapsName(uint32_t generation) { return String::format<32>("filemaps.%u", generation); }
+};
+
+/*
+ * All the file maps of one indexed file in one file, mapped once. The file
+ * starts with a table of contents listing each section's type, offset and
+ * size, sections start at a cache line boundary.
+ *
+ * [uint32_t magic][uint32_t version][uint32_t sectionCount][uint32_t reserved]
+ * [char digest[DigestSize]]
+ * [uint32_t type][uint32_t offset][uint32_t size][uint32_t reserved] x sectionCount
+ * [section data]...
+ *
+ * The digest covers the types and data of all sections so rp can tell that
+ * the maps it just encoded are identical to the ones rdm already has.
+ *
+ * Files are never rewritten in place. Every indexing run writes a new
+ * generation and publishes it with rename(2) so readers don't need locks, a
+ * loaded container stays valid for as long as it is alive and doesn't keep
+ * the file open.
+ */
+class FileMapContainer : public std::enable_shared_from_this<FileMapContainer>
+{
+public:
+    FileMapContainer()
+        : mPointer(0), mSize(0), mMapped(false)
+    {}
+
+    ~FileMapContainer()
+    {
+        if (mMapped) {
+            assert(mPointer);
+            munmap(const_cast<char*>(mPointer), mSize);
+        }
+    }
+
+    enum {
+        Magic = 0x63614d46,
+        Version = 2,
+        DigestSize = 32,
+        HeaderSize = (sizeof(uint32_t) * 4) + DigestSize,
+        EntrySize = sizeof(uint32_t) * 4,
+        SectionAlignment = 64
+    };
+
+    struct Section
+    {
+        Section(uint32_t t = 0, String &&d = String())
+            : type(t), data(std::move(d))
+        {}
+
+        uint32_t type;
+        String data;
+    };
+
+    bool load(const Path &path, String *error = 0)
+    {
+        assert(!mPointer);
+        int fd;
+        eintrwrap(fd, ::open(path.constData(), O_RDONLY));
+        if (fd == -1) {
+            if (error) {
+                *error = Rct::strerror();
+                *error << " " << __LINE__;
+            }
+            return false;
+        }
+        struct stat st;
+        const char *pointer = 0;
+        if (fstat(fd, &st)) {
+            if (error) {
+                *error = Rct::strerror();
+                *error << " " << __LINE__;
+            }
+        } else if (static_cast<size_t>(st.st_size) < HeaderSize) {
+            if (error)
+                *error = "Truncated file map container";
+        } else {
+            pointer = static_cast<const char*>(mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+            if (pointer == MAP_FAILED) {
+                pointer = 0;
+                if (error) {
+                    *error = Rct::strerror();
+                    *error << " " << __LINE__;
+                }
+            }
+        }
+
+        if (pointer && !init(pointer, st.st_size, std::shared_ptr<void>(), error)) {
+            munmap(const_cast<char*>(pointer), st.st_size);
+            pointer = 0;
+        }
+
+        // the mapping outlives the descriptor
+        int ret;
+        eintrwrap(ret, ::close(fd));
+        mMapped = pointer;
+        return pointer;
+    }
+
+    /*
+     * Use a container that lives in memory owned by someone else, e.g. a
+     * segment of a PackStore. owner is kept alive as long as the container
+     * or any map opened from it.
+     */
+    bool init(const char *pointer, uint32_t size, const std::shared_ptr<void> &owner, String *error = 0)
+    {
+        if (size < HeaderSize) {
+            if (error)
+                *error = "Truncated file map container";
+            return false;
+        }
+        uint32_t header[HeaderSize / sizeof(uint32_t)];
+        memcpy(header, pointer, HeaderSize);
+        if (header[0] != Magic || header[1] != Version) {
+            if (error)
+                *error = String::format<64>("Wrong file map container version %u, expected %u",
+                                            header[0] == Magic ? header[1] : 0, Version);
+            return false;
+        }
+        const uint32_t count = header[2];
+        if (count > (size - HeaderSize) / EntrySize) {
+            if (error)
+                *error = "Truncated file map container";
+            return false;
+        }
+        for (uint32_t i=0; i<count; ++i) {
+            uint32_t entry[EntrySize / sizeof(uint32_t)];
+            memcpy(entry, pointer + HeaderSize + (i * EntrySize), EntrySize);
+            if (entry[1] > size || entry[2] > size - entry[1]) {
+                if (error)
+                    *error = String::format<64>("Truncated section %u in file map container", entry[0]);
+                mSections.clear();
+                return false;
+            }
+            mSections[entry[0]] = std::make_pair(entry[1], entry[2]);
+        }
+        mPointer = pointer;
+        mSize = size;
+        mOwner = owner;
+        return true;
+    }
+
+    bool contains(uint32_t type) const { return mSections.contains(type); }
+    uint32_t size() const { return mSize; }
+    String digest() const { return mPointer ? String(mPointer + (sizeof(uint32_t) * 4), DigestSize) : String(); }
+
+    static String digest(const List<Section> &sections)
+    {
+        SHA256 sha;
+        for (const Section &section : sections) {
+            const uint32_t entry[] = { section.type, static_cast<uint32_t>(section.data.size()) };
+            sha.update(reinterpret_cast<const char*>(entry), sizeof(entry));
+            sha.update(section.data.constData(), section.data.size());
+        }
+        const String ret = sha.hash(SHA256::Raw);
+        assert(ret.size() == DigestSize);
+        return ret;
+    }
+
+    // T is a FileMap or anything else with the same init()
+    template <typename T>
+    bool open(uint32_t type, T &fileMap, String *error = 0)
+    {
+        const auto it = mSections.find(type);
+        if (it == mSections.end()) {
+            if (error)
+                *error = String::format<64>("No section %u in file map container", type);
+            return false;
+        }
+        return fileMap.init(mPointer + it->second.first, it->second.second, shared_from_this(), error);
+    }
+
+    // The sections are written with writev(2) straight from their buffers
+    // so the container is never assembled in memory.
+    static size_t write(const Path &path, const List<Section> &sections, const String &digest = String())
+    {
+        const Path tmp = String::format<256>("%s.%d", path.constData(), getpid());
+        int fd = ::open(tmp.constData(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if (fd == -1) {
+            if (!Path::mkdir(path.parentDir(), Path::Recursive))
+                return 0;
+            fd = ::open(tmp.constData(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+            if (fd == -1)
+                return 0;
+        }
+        static const char padding[SectionAlignment] = { 0 };
+        const String header = encodeHeader(sections, digest.isEmpty() ? FileMapContainer::digest(sections) : digest);
+        List<iovec> iov;
+        iov.reserve(1 + (sections.size() * 2));
+        iov.append(iovec { const_cast<char*>(header.constData()), header.size() });
+        size_t size = header.size();
+        for (const Section &section : sections) {
+            if (const size_t pad = align(size) - size) {
+                iov.append(iovec { const_cast<char*>(padding), pad });
+                size += pad;
+            }
+            if (!section.data.isEmpty()) {
+                iov.append(iovec { const_cast<char*>(section.data.constData()), section.data.size() });
+                size += section.data.size();
+            }
+        }
+        bool ok = writeAll(fd, iov);
+        if (::close(fd))
+            ok = false;
+        if (ok)
+            ok = !::rename(tmp.constData(), path.constData());
+        if (!ok)
+            unlink(tmp.constData());
+        return ok ? size : 0;
+    }
+
+    // header and table of contents, padded to where the first section starts
+    static String encodeHeader(const List<Section> &sections, const String &digest)
+    {
+        assert(digest.size() == DigestSize);
+        const uint32_t count = sections.size();
+        String out;
+        out.reserve(align(HeaderSize + (count * EntrySize)));
+        const uint32_t header[] = { Magic, Version, count, 0 };
+        out.append(reinterpret_cast<const char*>(header), sizeof(header));
+        out.append(digest);
+        uint32_t offset = align(HeaderSize + (count * EntrySize));
+        for (const Section &section : sections) {
+            const uint32_t entry[] = { section.type, offset, static_cast<uint32_t>(section.data.size()), 0 };
+            out.append(reinterpret_cast<const char*>(entry), sizeof(entry));
+            offset = align(offset + section.data.size());
+        }
+        out.resize(align(out.size()));
+        return out;
+    }
+private:
+    static uint32_t align(uint32_t offset) { return ((offset + SectionAlignment - 1) / SectionAlignment) * SectionAlignment; }
+
+    static bool writeAll(int fd, List<iovec> &iov)
+    {
+        iovec *vec = iov.data();
+        int count = iov.size();
+        while (count) {
+            ssize_t w;
+            eintrwrap(w, ::writev(fd, vec, std::min(count, IOV_MAX)));
+            if (w <= 0)
+                return false;
+            while (count && static_cast<size_t>(w) >= vec->iov_len) {
+                w -= vec->iov_len;
+                ++vec;
+                --count;
+            }
+            if (w) {
+                vec->iov_base = static_cast<char*>(vec->iov_base) + w;
+                vec->iov_len -= w;
+            }
+        }
+        return true;
+    }
+
+    const char *mPointer;
+    uint32_t mSize;
+    bool mMapped;
+    std::shared_ptr<void> mOwner;
+    // type -> offset, size
+    Hash<uint32_t, std::pair<uint32_t, uint32_t> > mSections;
+};
+
+#endif
@@ -38,23 +38,36 @@ int FindSymbolsJob::execute()
     int ret = 2;
     if (std::shared_ptr<Project> proj = project()) {
         Set<Symbol> symbols;
-        auto inserter = [proj, this, &symbols](Project::SymbolMatchType type,
-                                               const String &symbolName,
-                                               const Set<Location> &locations) {
+        // fuzzy matches come best first, each match is sorted on its own
+        List<RTags::SortedSymbol> ranked;
+        Set<Location> seen;
+        auto inserter = [proj, this, &symbols, &ranked, &seen](Project::SymbolMatchType type,
+                                                               const String &symbolName,
+                                                               const Set<Location> &locations) {
             if (type == Project::StartsWith) {
                 const size_t paren = symbolName.indexOf('(');
                 if (paren == String::npos || paren != string.size() || RTags::isFunctionVariable(symbolName))
                     return;
             }
+            Set<Symbol> matched;
             for (const auto &it : locations) {
                 const Symbol sym = proj->findSymbol(it);
                 if (!sym.isNull() || sym.flags & Symbol::FileSymbol)
-                    symbols.insert(sym);
+                    matched.insert(sym);
+            }
+            if (type != Project::Fuzzy) {
+                symbols.unite(matched);
+                return;
+            }
+            for (const RTags::SortedSymbol &node : proj->sort(matched, queryFlags())) {
+                if (seen.insert(node.location))
+                    ranked.append(node);
             }
         };
-        proj->findSymbols(string, inserter, queryFlags(), fileFilter());
-        if (!symbols.isEmpty()) {
-            const List<RTags::SortedSymbol> sorted = proj->sort(symbols, queryFlags());
+        const std::shared_ptr<QueryMessage> query = queryMessage();
+        proj->findSymbols(string, inserter, queryFlags(), fileFilter(), query ? query->max() : -1);
+        if (!symbols.isEmpty() || !ranked.isEmpty()) {
+            const List<RTags::SortedSymbol> sorted = ranked.isEmpty() ? proj->sort(symbols, queryFlags()) : ranked;
             const Flags<WriteFlag> writeFlags = fileFilter() ? Unfiltered : NoWriteFlags;
             const int count = sorted.size();
             ret = count ? 0 : 1;
@@ -0,0 +1,121 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef FuzzyMatch_h
+#define FuzzyMatch_h
+
+#include <ctype.h>
+#include <algorithm>
+#include <limits>
+
+#include "FileMap.h"
+#include "rct/List.h"
+#include "rct/String.h"
+
+/*
+ * Scores a symbol name against a query whose characters have to appear in
+ * the name in order, ignoring case. Like the word boundary matches of
+ * StringTokenizer, characters matched at the start of a word ("gsn" in
+ * getSymbolName or get_symbol_name) and runs of consecutive characters score
+ * higher, longer names score a little lower.
+ */
+class FuzzyMatch
+{
+public:
+    enum {
+        Match = 16,
+        Boundary = 24,
+        Consecutive = 16,
+        CaseMatch = 1
+    };
+
+    FuzzyMatch(const String &query)
+    {
+        // whitespace just separates words in the query
+        for (char ch : query) {
+            if (!isspace(static_cast<unsigned char>(ch)))
+                mQuery.append(ch);
+        }
+    }
+
+    const String &query() const { return mQuery; }
+
+    // no name of this size can score more than this
+    int maxScore(uint32_t size) const
+    {
+        return static_cast<int>(mQuery.size()) * (Match + Boundary + Consecutive + CaseMatch) - static_cast<int>(size);
+    }
+
+    bool score(const FileMapString &name, int &score) const
+    {
+        const uint32_t size = name.size(), count = mQuery.size();
+        if (count > size)
+            return false;
+        if (!count) {
+            score = maxScore(size);
+            return true;
+        }
+
+        // best score for the query so far with its last character at name[i]
+        const int none = std::numeric_limits<int>::min();
+        mPrevious.assign(size, none);
+        mCurrent.resize(size);
+        for (uint32_t q=0; q<count; ++q) {
+            const char ch = mQuery.at(q);
+            int best = none; // best of mPrevious[0, i - 1)
+            bool found = false;
+            for (uint32_t i=0; i<size; ++i) {
+                if (q && i >= 2)
+                    best = std::max(best, mPrevious[i - 2]);
+                mCurrent[i] = none;
+                const char c = name.data()[i];
+                if (tolower(static_cast<unsigned char>(c)) != tolower(static_cast<unsigned char>(ch)))
+                    continue;
+                int s = Match + (c == ch ? CaseMatch : 0) + (isBoundary(name, i) ? Boundary : 0);
+                if (q) {
+                    const int consecutive = i && mPrevious[i - 1] != none ? mPrevious[i - 1] + Consecutive : none;
+                    const int previous = std::max(best, consecutive);
+                    if (previous == none)
+                        continue;
+                    s += previous;
+                }
+                mCurrent[i] = s;
+                found = true;
+            }
+            if (!found)
+                return false;
+            std::swap(mPrevious, mCurrent);
+        }
+        score = *std::max_element(mPrevious.begin(), mPrevious.end()) - static_cast<int>(size);
+        return true;
+    }
+private:
+    static bool isBoundary(const FileMapString &name, uint32_t i)
+    {
+        if (!i)
+            return true;
+        const unsigned char prev = name.data()[i - 1], ch = name.data()[i];
+        if (!isalnum(prev))
+            return isalnum(ch);
+        if (isupper(ch))
+            return islower(prev) || isdigit(prev) || (i + 1 < name.size() && islower(static_cast<unsigned char>(name.data()[i + 1])));
+        return !isdigit(ch) != !isdigit(prev);
+    }
+
+    String mQuery;
+    mutable List<int> mPrevious, mCurrent;
+};
+
+#endif
@@ -29,11 +29,13 @@ public:
     enum { MessageId = IndexDataMessageId };
 
     IndexDataMessage(const std::shared_ptr<IndexerJob> &job)
-        : RTagsMessage(MessageId), mParseTime(0), mId(0), mIndexerJobFlags(job->flags), mBytesWritten(0)
+        : RTagsMessage(MessageId), mParseTime(0), mId(0), mFileMapGeneration(0), mIndexerJobFlags(job->flags), mBytesWritten(0),
+          mEncodeDuration(0), mWriteDuration(0), mWriteFilesDuration(0)
     {}
 
     IndexDataMessage()
-        : RTagsMessage(MessageId), mParseTime(0), mId(0), mBytesWritten(0)
+        : RTagsMessage(MessageId), mParseTime(0), mId(0), mFileMapGeneration(0), mBytesWritten(0),
+          mEncodeDuration(0), mWriteDuration(0), mWriteFilesDuration(0)
     {}
 
     void encode(Serializer &serializer) const;
@@ -75,6 +77,10 @@ public:
     uint64_t id() const { return mId; }
     void setId(uint64_t i) { mId = i; }
 
+    // generation of the file maps written for the visited files
+    uint32_t fileMapGeneration() const { return mFileMapGeneration; }
+    void setFileMapGeneration(uint32_t generation) { mFileMapGeneration = generation; }
+
     uint64_t parseTime() const { return mParseTime; }
     void setParseTime(uint64_t time) { mParseTime = time; }
 
@@ -96,19 +102,44 @@ public:
     Hash<uint32_t, Flags<FileFlag> > &files() { return mFiles; }
     const Hash<uint32_t, Flags<FileFlag> > &files() const { return mFiles; }
 
+    // visited files whose file maps came out identical to the generation rdm
+    // had for them and weren't written again, fileId -> generation
+    Hash<uint32_t, uint32_t> &unchangedFileMaps() { return mUnchangedFileMaps; }
+    const Hash<uint32_t, uint32_t> &unchangedFileMaps() const { return mUnchangedFileMaps; }
+
+    // digests of the file maps that were written, see FileMapContainer
+    Hash<uint32_t, String> &fileMapDigests() { return mFileMapDigests; }
+    const Hash<uint32_t, String> &fileMapDigests() const { return mFileMapDigests; }
+
     size_t bytesWritten() const { return mBytesWritten; }
     void setBytesWritten(size_t bytes) { mBytesWritten = bytes; }
+
+    // ms spent encoding and writing the file maps, summed over rp's writer
+    // threads, and the wall time of writing all of them
+    int encodeDuration() const { return mEncodeDuration; }
+    int writeDuration() const { return mWriteDuration; }
+    int writeFilesDuration() const { return mWriteFilesDuration; }
+    void setWriteDurations(int encode, int write, int writeFiles)
+    {
+        mEncodeDuration = encode;
+        mWriteDuration = write;
+        mWriteFilesDuration = writeFiles;
+    }
 private:
     Path mProject;
     uint64_t mParseTime, mId;
+    uint32_t mFileMapGeneration;
     Flags<IndexerJob::Flag> mIndexerJobFlags; // indexerjobflags
     String mMessage; // used as output for dump when flags & Dump
     FixIts mFixIts;
     Diagnostics mDiagnostics;
     Includes mIncludes;
     Hash<uint32_t, Flags<FileFlag> > mFiles;
+    Hash<uint32_t, uint32_t> mUnchangedFileMaps;
+    Hash<uint32_t, String> mFileMapDigests;
     Flags<Flag> mFlags;
     size_t mBytesWritten;
+    int mEncodeDuration, mWriteDuration, mWriteFilesDuration;
 };
 
 RCT_FLAGS(IndexDataMessage::Flag);
@@ -116,14 +147,16 @@ RCT_FLAGS(IndexDataMessage::FileFlag);
 
 inline void IndexDataMessage::encode(Serializer &serializer) const
 {
-    serializer << mProject << mParseTime << mId << mIndexerJobFlags << mMessage
-               << mFixIts << mIncludes << mDiagnostics << mFiles << mFlags << mBytesWritten;
+    serializer << mProject << mParseTime << mId << mFileMapGeneration << mIndexerJobFlags << mMessage
+               << mFixIts << mIncludes << mDiagnostics << mFiles << mUnchangedFileMaps << mFileMapDigests << mFlags << mBytesWritten
+               << mEncodeDuration << mWriteDuration << mWriteFilesDuration;
 }
 
 inline void IndexDataMessage::decode(Deserializer &deserializer)
 {
-    deserializer >> mProject >> mParseTime >> mId >> mIndexerJobFlags >> mMessage
-                 >> mFixIts >> mIncludes >> mDiagnostics >> mFiles >> mFlags >> mBytesWritten;
+    deserializer >> mProject >> mParseTime >> mId >> mFileMapGeneration >> mIndexerJobFlags >> mMessage
+                 >> mFixIts >> mIncludes >> mDiagnostics >> mFiles >> mUnchangedFileMaps >> mFileMapDigests >> mFlags >> mBytesWritten
+                 >> mEncodeDuration >> mWriteDuration >> mWriteFilesDuration;
 }
 
 #endif
@@ -28,7 +28,7 @@ IndexerJob::IndexerJob(const SourceList &s,
                        Flags<Flag> f,
                        const std::shared_ptr<Project> &p,
                        const UnsavedFiles &u)
-    : id(0), flags(f),
+    : id(0), fileMapGeneration(0), flags(f),
       project(p->path()), unsavedFiles(u), crashCount(0), mCachedPriority(INT_MIN)
 {
     sources.append(s.front());
@@ -113,10 +113,13 @@ String IndexerJob::encode() const
         Serializer serializer(ret);
         serializer.write("1234", sizeof(int)); // for size
         std::shared_ptr<Project> proj = Server::instance()->project(project);
+        assert(proj);
+        assert(fileMapGeneration);
         const Server::Options &options = Server::instance()->options();
         serializer << static_cast<uint16_t>(RTags::DatabaseVersion)
                    << options.sandboxRoot
                    << id
+                   << fileMapGeneration
                    << options.socketFile
                    << project
                    << static_cast<uint32_t>(sources.size());
@@ -175,7 +178,6 @@ String IndexerJob::encode() const
             assert(!sourceFile.isEmpty());
             copy.encode(serializer, Source::IgnoreSandbox);
         }
-        assert(proj);
         Flags<Flag> f = flags;
         if (Server::instance()->isActiveBuffer(fileId()))
             f |= Active;
@@ -55,6 +55,8 @@ public:
     void recalculatePriority();
 
     uint64_t id;
+    // the generation rp writes the file maps as, a new one every launch
+    uint32_t fileMapGeneration;
     SourceList sources;
     Path sourceFile;
     Flags<Flag> flags;
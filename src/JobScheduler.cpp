@@ -181,6 +181,7 @@ void JobScheduler::startJobs()
         jobNode->process = process;
         assert(!(jobNode->job->flags & ~IndexerJob::Type_Mask));
         jobNode->job->flags |= IndexerJob::Running;
+        jobNode->job->fileMapGeneration = project->nextFileMapGeneration();
         process->write(jobNode->job->encode());
         jobNode->started = Rct::monoMs();
         mActiveByProcess[process] = jobNode;
@@ -34,6 +34,7 @@ ListSymbolsJob::ListSymbolsJob(const std::shared_ptr<QueryMessage> &query, const
 int ListSymbolsJob::execute()
 {
     Set<String> out;
+    List<String> ranked;
     std::shared_ptr<Project> proj = project();
     if (proj) {
         if (queryFlags() & QueryMessage::WildcardSymbolNames
@@ -57,16 +58,24 @@ int ListSymbolsJob::execute()
         if (!paths.isEmpty()) {
             out = listSymbolsWithPathFilter(proj, paths);
         } else {
-            out = listSymbols(proj);
+            out = listSymbols(proj, ranked);
         }
     }
 
     if (queryFlags() & QueryMessage::Elisp) {
         write("(list", IgnoreMax | DontQuote);
-        for (Set<String>::const_iterator it = out.begin(); it != out.end(); ++it) {
-            write(*it);
+        if (!ranked.isEmpty()) {
+            for (const String &symbol : ranked)
+                write(symbol);
+        } else {
+            for (Set<String>::const_iterator it = out.begin(); it != out.end(); ++it) {
+                write(*it);
+            }
         }
         write(")", IgnoreMax | DontQuote);
+    } else if (!ranked.isEmpty()) {
+        for (const String &symbol : ranked)
+            write(symbol);
     } else {
         List<String> sorted = out.toList();
         if (queryFlags() & QueryMessage::ReverseSort) {
@@ -99,11 +108,10 @@ Set<String> ListSymbolsJob::listSymbolsWithPathFilter(const std::shared_ptr<Proj
             continue;
         const int count = symbols->count();
         for (int j=0; j<count; ++j) {
-            const Symbol &symbol = symbols->valueAt(j);
-            if (!filterKind(symbol)) {
+            if (!filterKind(symbols->valueAt(j, Symbol::Hot))) {
                 continue;
             }
-            const String &symbolName = symbol.symbolName;
+            const String symbolName = symbols->valueAt(j, Symbol::Names).symbolName;
             if (symbolName.isEmpty())
                 continue;
             if (!string.isEmpty()) {
@@ -132,16 +140,16 @@ Set<String> ListSymbolsJob::listSymbolsWithPathFilter(const std::shared_ptr<Proj
     return out;
 }
 
-Set<String> ListSymbolsJob::listSymbols(const std::shared_ptr<Project> &project) const
+Set<String> ListSymbolsJob::listSymbols(const std::shared_ptr<Project> &project, List<String> &ranked) const
 {
     const bool hasFilter = QueryJob::hasFilter();
     const bool hasKindFilter = QueryJob::hasKindFilter();
     const bool stripParentheses = queryFlags() & QueryMessage::StripParentheses;
 
     Set<String> out;
-    auto inserter = [this, &project, hasFilter, hasKindFilter, stripParentheses, &out](Project::SymbolMatchType,
-                                                                                       const String &str,
-                                                                                       const Set<Location> &locations) {
+    auto inserter = [this, &project, hasFilter, hasKindFilter, stripParentheses, &out, &ranked](Project::SymbolMatchType type,
+                                                                                                const String &str,
+                                                                                                const Set<Location> &locations) {
         if (hasFilter) {
             bool ok = false;
             for (const auto &l : locations) {
@@ -158,17 +166,22 @@ Set<String> ListSymbolsJob::listSymbols(const std::shared_ptr<Project> &project)
             if (!filterKind(sym))
                 return;
         }
+        auto insert = [&out, &ranked, type](const String &symbol) {
+            if (out.insert(symbol) && type == Project::Fuzzy)
+                ranked.append(symbol);
+        };
         const int paren = str.indexOf('(');
         if (paren == -1) {
-            out.insert(str);
+            insert(str);
         } else {
             if (!RTags::isFunctionVariable(str))
-                out.insert(str.left(paren));
+                insert(str.left(paren));
             if (!stripParentheses)
-                out.insert(str);
+                insert(str);
         }
     };
 
-    project->findSymbols(string, inserter, queryFlags());
+    const std::shared_ptr<QueryMessage> query = queryMessage();
+    project->findSymbols(string, inserter, queryFlags(), 0, query ? query->max() : -1);
     return out;
 }
@@ -29,7 +29,8 @@ public:
 protected:
     virtual int execute() override;
     Set<String> listSymbolsWithPathFilter(const std::shared_ptr<Project> &project, const List<Path> &paths) const;
-    Set<String> listSymbols(const std::shared_ptr<Project> &project) const;
+    // ranked has the fuzzy matches in the order they were found, best first
+    Set<String> listSymbols(const std::shared_ptr<Project> &project, List<String> &ranked) const;
 private:
     String string;
 };
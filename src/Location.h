@@ -120,6 +120,13 @@ public:
     inline uint32_t fileId() const { return static_cast<uint32_t>(value & FILEID_MASK); }
     inline uint32_t line() const { return static_cast<uint32_t>((value & LINE_MASK) >> FileBits); }
     inline uint32_t column() const { return static_cast<uint32_t>((value & COLUMN_MASK) >> (FileBits + LineBits)); }
+    inline uint64_t sortKey() const
+    {
+        // same order as compare(), usable with plain integer comparisons
+        return ((static_cast<uint64_t>(fileId()) << (LineBits + ColumnBits))
+                | (static_cast<uint64_t>(line()) << ColumnBits)
+                | column());
+    }
 
     inline Path path() const
     {
@@ -0,0 +1,448 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "PackStore.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "rct/EventLoop.h"
+#include "rct/Log.h"
+#include "rct/Rct.h"
+#include "rct/Set.h"
+
+static const char sPadding[PackStore::RecordAlignment] = { 0 };
+
+PackStore::Mapping::~Mapping()
+{
+    munmap(const_cast<char*>(pointer), size);
+}
+
+PackStore::PackStore(const Path &dir)
+    : mDir(dir.ensureTrailingSlash()), mGeneration(0), mCompacting(false)
+{
+}
+
+PackStore::~PackStore()
+{
+    for (const auto &segment : mSegments) {
+        int ret;
+        eintrwrap(ret, ::close(segment.second.fd));
+    }
+}
+
+String PackStore::recordHeader(uint32_t fileId, uint32_t size, uint32_t flags)
+{
+    String ret;
+    ret.resize(RecordAlignment);
+    const uint32_t header[] = { Magic, fileId, size, flags };
+    memcpy(ret.data(), header, sizeof(header));
+    return ret;
+}
+
+bool PackStore::openSegment(uint32_t id, Segment &segment, String *error)
+{
+    segment.path = segmentPath(id);
+    eintrwrap(segment.fd, ::open(segment.path.constData(), O_RDWR|O_CREAT, 0644));
+    if (segment.fd == -1) {
+        if (error)
+            *error = "Failed to open " + segment.path + ": " + Rct::strerror();
+        return false;
+    }
+    struct stat st;
+    if (fstat(segment.fd, &st)) {
+        if (error)
+            *error = "Failed to stat " + segment.path + ": " + Rct::strerror();
+        return false;
+    }
+    segment.size = st.st_size;
+    if (segment.size < RecordAlignment) {
+        String header;
+        header.resize(RecordAlignment);
+        const uint32_t magic[] = { Magic, Version };
+        memcpy(header.data(), magic, sizeof(magic));
+        if (::ftruncate(segment.fd, 0) == -1
+            || ::pwrite(segment.fd, header.constData(), header.size(), 0) != static_cast<ssize_t>(header.size())) {
+            if (error)
+                *error = "Failed to write " + segment.path + ": " + Rct::strerror();
+            return false;
+        }
+        segment.size = RecordAlignment;
+    }
+    return true;
+}
+
+std::shared_ptr<PackStore::Mapping> PackStore::mapping(Segment &segment)
+{
+    if (!segment.mapping || segment.mapping->size < segment.size) {
+        // Map the whole MaxSegmentSize so records appended later are already
+        // mapped, only the pages of the file that have been written are ever
+        // touched. A segment only outgrows that with a single record larger
+        // than MaxSegmentSize, maps handed out earlier keep their old mapping
+        // alive.
+        const size_t size = std::max<size_t>(segment.size, MaxSegmentSize);
+        void *pointer = mmap(0, size, PROT_READ, MAP_SHARED, segment.fd, 0);
+        if (pointer == MAP_FAILED) {
+            error() << "Failed to map" << segment.path << Rct::strerror();
+            return std::shared_ptr<Mapping>();
+        }
+        segment.mapping = std::make_shared<Mapping>(static_cast<const char*>(pointer), size);
+    }
+    return segment.mapping;
+}
+
+bool PackStore::load(String *err)
+{
+    assert(mSegments.isEmpty());
+    Path::mkdir(mDir, Path::Recursive);
+    Set<uint32_t> ids;
+    mDir.visit([&ids](const Path &path) {
+            const char *fileName = path.fileName();
+            if (!strncmp(fileName, "segment.", 8)) {
+                char *end;
+                const unsigned long id = strtoul(fileName + 8, &end, 10);
+                if (*end) {
+                    // leftover from a compaction that never finished
+                    path.rm();
+                } else {
+                    ids.insert(id);
+                }
+            }
+            return Path::Continue;
+        });
+
+    for (uint32_t id : ids) {
+        Segment &segment = mSegments[id];
+        if (!openSegment(id, segment, err))
+            return false;
+        std::shared_ptr<Mapping> map = mapping(segment);
+        if (!map) {
+            if (err)
+                *err = "Failed to map " + segment.path;
+            return false;
+        }
+        uint32_t header[4];
+        memcpy(header, map->pointer, sizeof(uint32_t) * 2);
+        if (header[0] != Magic || header[1] != Version) {
+            if (err)
+                *err = String::format<128>("Wrong pack segment version %s", segment.path.constData());
+            return false;
+        }
+        uint32_t offset = RecordAlignment;
+        while (offset + RecordAlignment <= segment.size) {
+            memcpy(header, map->pointer + offset, sizeof(header));
+            const uint32_t dataOffset = offset + RecordAlignment;
+            // subtracted so a damaged size can't wrap around, the padding
+            // of the record has to be there too
+            if (header[0] != Magic || header[2] > segment.size - dataOffset
+                || align(header[2]) > segment.size - dataOffset) {
+                break;
+            }
+            const uint32_t recordSize = RecordAlignment + align(header[2]);
+            auto it = mEntries.find(header[1]);
+            if (it != mEntries.end())
+                mSegments[it->second.segment].live -= RecordAlignment + align(it->second.size);
+            if (header[3] & Tombstone) {
+                if (it != mEntries.end())
+                    mEntries.erase(it);
+                segment.tombstones += recordSize;
+            } else {
+                mEntries[header[1]] = { id, dataOffset, header[2] };
+                segment.live += recordSize;
+            }
+            offset += recordSize;
+        }
+        if (offset != segment.size) {
+            warning() << "Truncating" << segment.path << "from" << segment.size << "to" << offset;
+            if (::ftruncate(segment.fd, offset) == -1) {
+                if (err)
+                    *err = "Failed to truncate " + segment.path + ": " + Rct::strerror();
+                return false;
+            }
+            segment.size = offset;
+        }
+    }
+    startCompaction();
+    return true;
+}
+
+void PackStore::clear()
+{
+    for (const auto &segment : mSegments) {
+        int ret;
+        eintrwrap(ret, ::close(segment.second.fd));
+    }
+    mSegments.clear();
+    mEntries.clear();
+    ++mGeneration;
+    Path::rmdir(mDir);
+    Path::mkdir(mDir, Path::Recursive);
+}
+
+bool PackStore::insert(uint32_t fileId, const String &data)
+{
+    if (!append(fileId, data.constData(), data.size(), 0))
+        return false;
+    startCompaction();
+    return true;
+}
+
+void PackStore::remove(uint32_t fileId)
+{
+    if (mEntries.contains(fileId))
+        append(fileId, 0, 0, Tombstone);
+}
+
+bool PackStore::append(uint32_t fileId, const char *data, uint32_t size, uint32_t flags)
+{
+    const uint32_t recordSize = RecordAlignment + align(size);
+    if (mSegments.isEmpty() || (mSegments.rbegin()->second.size > RecordAlignment
+                                && mSegments.rbegin()->second.size + recordSize > MaxSegmentSize)) {
+        const uint32_t id = mSegments.isEmpty() ? 1 : mSegments.rbegin()->first + 1;
+        String err;
+        Segment segment;
+        if (!openSegment(id, segment, &err)) {
+            error() << "Failed to create pack segment" << err;
+            if (segment.fd != -1)
+                ::close(segment.fd);
+            return false;
+        }
+        mSegments[id] = segment;
+    }
+    const uint32_t id = mSegments.rbegin()->first;
+    Segment &segment = mSegments.rbegin()->second;
+
+    String record = recordHeader(fileId, size, flags);
+    record.reserve(recordSize);
+    record.append(data, size);
+    record.append(sPadding, recordSize - record.size());
+    if (::pwrite(segment.fd, record.constData(), record.size(), segment.size) != static_cast<ssize_t>(record.size())) {
+        error() << "Failed to write to" << segment.path << Rct::strerror();
+        // don't leave a partial record behind
+        if (::ftruncate(segment.fd, segment.size) == -1)
+            error() << "Failed to truncate" << segment.path << Rct::strerror();
+        return false;
+    }
+
+    auto it = mEntries.find(fileId);
+    if (it != mEntries.end())
+        mSegments[it->second.segment].live -= RecordAlignment + align(it->second.size);
+    if (flags & Tombstone) {
+        if (it != mEntries.end())
+            mEntries.erase(it);
+        segment.tombstones += recordSize;
+    } else {
+        mEntries[fileId] = { id, segment.size + RecordAlignment, size };
+        segment.live += recordSize;
+    }
+    segment.size += recordSize;
+    return true;
+}
+
+bool PackStore::find(uint32_t fileId, const char **data, uint32_t *size, std::shared_ptr<void> *owner)
+{
+    const auto it = mEntries.find(fileId);
+    if (it == mEntries.end())
+        return false;
+    auto segment = mSegments.find(it->second.segment);
+    assert(segment != mSegments.end());
+    std::shared_ptr<Mapping> map = mapping(segment->second);
+    if (!map)
+        return false;
+    *data = map->pointer + it->second.offset;
+    *size = it->second.size;
+    *owner = map;
+    return true;
+}
+
+size_t PackStore::size() const
+{
+    size_t ret = 0;
+    for (const auto &segment : mSegments)
+        ret += segment.second.size;
+    return ret;
+}
+
+size_t PackStore::liveSize() const
+{
+    size_t ret = 0;
+    for (const auto &segment : mSegments)
+        ret += segment.second.live;
+    return ret;
+}
+
+void PackStore::startCompaction()
+{
+    if (mCompacting || mSegments.size() < 2)
+        return;
+
+    // the last segment is still being appended to, tombstones can only be
+    // dropped from the oldest segment since they hide records in earlier ones
+    uint32_t victim = 0, best = 0;
+    const uint32_t oldest = mSegments.begin()->first;
+    const uint32_t active = mSegments.rbegin()->first;
+    for (const auto &segment : mSegments) {
+        if (segment.first == active)
+            break;
+        const Segment &seg = segment.second;
+        const uint32_t payload = seg.size - RecordAlignment;
+        uint32_t garbage = payload - seg.live;
+        if (segment.first != oldest)
+            garbage -= seg.tombstones;
+        if (garbage * 2 > payload && garbage > best) {
+            best = garbage;
+            victim = segment.first;
+        }
+    }
+    if (!victim)
+        return;
+
+    Segment &segment = mSegments[victim];
+    std::shared_ptr<Mapping> map = mapping(segment);
+    if (!map)
+        return;
+    Hash<uint32_t, uint32_t> live;
+    for (const auto &entry : mEntries) {
+        if (entry.second.segment == victim)
+            live[entry.first] = entry.second.offset;
+    }
+
+    mCompacting = true;
+    CompactionThread *thread = new CompactionThread(victim, segment.path, map, segment.size, std::move(live), victim != oldest);
+    thread->setAutoDelete(true);
+    std::weak_ptr<PackStore> that = shared_from_this();
+    const uint32_t generation = mGeneration;
+    thread->finished().connect<EventLoop::Move>([that, generation](uint32_t seg,
+                                                                   const Hash<uint32_t, std::pair<uint32_t, uint32_t> > &moved,
+                                                                   uint32_t tombstones, bool ok) {
+            if (auto strong = that.lock())
+                strong->onCompactionFinished(generation, seg, moved, tombstones, ok);
+        });
+    thread->start();
+}
+
+void PackStore::onCompactionFinished(uint32_t generation, uint32_t id,
+                                     const Hash<uint32_t, std::pair<uint32_t, uint32_t> > &moved,
+                                     uint32_t tombstones, bool ok)
+{
+    assert(mCompacting);
+    mCompacting = false;
+    const Path tmp = segmentPath(id) + ".compact";
+    auto it = mSegments.find(id);
+    if (!ok || generation != mGeneration || it == mSegments.end()) {
+        if (!ok)
+            error() << "Failed to compact" << segmentPath(id);
+        tmp.rm();
+        return;
+    }
+
+    Segment &segment = it->second;
+    if (::rename(tmp.constData(), segment.path.constData())) {
+        error() << "Failed to replace" << segment.path << Rct::strerror();
+        tmp.rm();
+        return;
+    }
+    // mappings of the old file stay valid until the last map using them is gone
+    int ret;
+    eintrwrap(ret, ::close(segment.fd));
+    segment.mapping.reset();
+    segment.live = segment.tombstones = 0;
+    String err;
+    if (!openSegment(id, segment, &err)) {
+        // the records are gone, drop them so they'll be indexed again
+        error() << "Failed to reopen compacted segment" << err;
+        for (auto entry = mEntries.begin(); entry != mEntries.end(); ) {
+            if (entry->second.segment == id) {
+                mEntries.erase(entry++);
+            } else {
+                ++entry;
+            }
+        }
+        if (segment.fd != -1)
+            ::close(segment.fd);
+        mSegments.erase(it);
+        return;
+    }
+
+    for (const auto &m : moved) {
+        auto entry = mEntries.find(m.first);
+        if (entry != mEntries.end() && entry->second.segment == id && entry->second.offset == m.second.first) {
+            entry->second.offset = m.second.second;
+            segment.live += RecordAlignment + align(entry->second.size);
+        }
+    }
+    // records that were replaced while the thread was copying them are
+    // dead, not tombstones, so the next compaction can reclaim them
+    segment.tombstones = tombstones;
+    if (!segment.live && !segment.tombstones && it != --mSegments.end()) {
+        eintrwrap(ret, ::close(segment.fd));
+        segment.path.rm();
+        mSegments.erase(it);
+    }
+    startCompaction();
+}
+
+PackStore::CompactionThread::CompactionThread(uint32_t segment, const Path &path, const std::shared_ptr<Mapping> &mapping,
+                                              uint32_t size, Hash<uint32_t, uint32_t> &&live, bool keepTombstones)
+    : mSegment(segment), mPath(path), mMapping(mapping), mSize(size), mLive(std::move(live)), mKeepTombstones(keepTombstones)
+{
+}
+
+void PackStore::CompactionThread::run()
+{
+    Hash<uint32_t, std::pair<uint32_t, uint32_t> > moved;
+    const Path tmp = mPath + ".compact";
+    FILE *f = fopen(tmp.constData(), "w");
+    bool ok = f;
+    if (ok)
+        ok = fwrite(mMapping->pointer, RecordAlignment, 1, f) == 1;
+    uint32_t offset = RecordAlignment, written = RecordAlignment, tombstones = 0;
+    while (ok && offset + RecordAlignment <= mSize) {
+        uint32_t header[4];
+        memcpy(header, mMapping->pointer + offset, sizeof(header));
+        const uint32_t dataOffset = offset + RecordAlignment;
+        if (header[0] != Magic || header[2] > mSize - dataOffset || align(header[2]) > mSize - dataOffset)
+            break;
+        const uint32_t recordSize = RecordAlignment + align(header[2]);
+        bool keep;
+        if (header[3] & Tombstone) {
+            keep = mKeepTombstones;
+        } else {
+            const auto it = mLive.find(header[1]);
+            keep = it != mLive.end() && it->second == dataOffset;
+        }
+        if (keep) {
+            ok = fwrite(mMapping->pointer + offset, recordSize, 1, f) == 1;
+            if (header[3] & Tombstone) {
+                tombstones += recordSize;
+            } else {
+                moved[header[1]] = std::make_pair(dataOffset, written + RecordAlignment);
+            }
+            written += recordSize;
+        }
+        offset += recordSize;
+    }
+    if (f && fclose(f))
+        ok = false;
+    if (!ok)
+        tmp.rm();
+    mFinished(mSegment, std::move(moved), tombstones, ok);
+}
@@ -0,0 +1,145 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef PackStore_h
+#define PackStore_h
+
+#include <memory>
+
+#include "rct/Hash.h"
+#include "rct/List.h"
+#include "rct/Map.h"
+#include "rct/Path.h"
+#include "rct/SignalSlot.h"
+#include "rct/String.h"
+#include "rct/Thread.h"
+
+/*
+ * Optional store for file map containers (see FileMapContainer). Instead of
+ * one file per indexed file the containers are appended to a few large
+ * segment files in the project's data dir. Segments are mapped once, with
+ * room for MaxSegmentSize so appends don't need a new mapping, and find()
+ * hands out slices of the mapping so no file is opened on the query path.
+ *
+ * Every record is [uint32_t magic][uint32_t fileId][uint32_t size][uint32_t
+ * flags] padded to RecordAlignment followed by the data, so data is aligned
+ * like a FileMapContainer expects. Removing a file appends a tombstone.
+ * Records in later segments win so the offset index can be rebuilt by
+ * scanning the segments in order.
+ *
+ * Superseded records are reclaimed by a background thread that rewrites a
+ * sealed segment with only its live records and replaces it under the same
+ * name, which keeps the order of the segments intact.
+ */
+class PackStore : public std::enable_shared_from_this<PackStore>
+{
+public:
+    PackStore(const Path &dir);
+    ~PackStore();
+
+    enum {
+        Magic = 0x6b636150,
+        Version = 1,
+        RecordAlignment = 64,
+        MaxSegmentSize = 64 * 1024 * 1024
+    };
+
+    bool load(String *error = 0);
+    void clear();
+
+    bool contains(uint32_t fileId) const { return mEntries.contains(fileId); }
+    bool insert(uint32_t fileId, const String &data);
+    void remove(uint32_t fileId);
+
+    /*
+     * Points *data to the container for fileId. owner keeps the segment
+     * mapping alive and has to outlive any use of *data.
+     */
+    bool find(uint32_t fileId, const char **data, uint32_t *size, std::shared_ptr<void> *owner);
+
+    size_t segmentCount() const { return mSegments.size(); }
+    size_t size() const;
+    size_t liveSize() const;
+
+    struct Mapping {
+        Mapping(const char *p, size_t s)
+            : pointer(p), size(s)
+        {}
+        ~Mapping();
+
+        const char *pointer;
+        // the mapped length, can be larger than the segment
+        const size_t size;
+    };
+private:
+    struct Entry {
+        uint32_t segment;
+        uint32_t offset, size;
+    };
+    struct Segment {
+        Segment()
+            : fd(-1), size(0), live(0), tombstones(0)
+        {}
+
+        Path path;
+        int fd;
+        // bytes in the file, in live records and in tombstones
+        uint32_t size, live, tombstones;
+        std::shared_ptr<Mapping> mapping;
+    };
+
+    class CompactionThread : public Thread
+    {
+    public:
+        CompactionThread(uint32_t segment, const Path &path, const std::shared_ptr<Mapping> &mapping, uint32_t size,
+                         Hash<uint32_t, uint32_t> &&live, bool keepTombstones);
+        virtual void run() override;
+
+        // segment, fileId -> (old offset, new offset), bytes in tombstones, success
+        Signal<std::function<void(uint32_t, Hash<uint32_t, std::pair<uint32_t, uint32_t> >, uint32_t, bool)> > &finished() { return mFinished; }
+    private:
+        const uint32_t mSegment;
+        const Path mPath;
+        const std::shared_ptr<Mapping> mMapping;
+        const uint32_t mSize;
+        const Hash<uint32_t, uint32_t> mLive;
+        const bool mKeepTombstones;
+        Signal<std::function<void(uint32_t, Hash<uint32_t, std::pair<uint32_t, uint32_t> >, uint32_t, bool)> > mFinished;
+    };
+
+    enum RecordFlag {
+        Tombstone = 0x1
+    };
+
+    Path segmentPath(uint32_t id) const { return String::format<256>("%ssegment.%u", mDir.constData(), id); }
+    bool append(uint32_t fileId, const char *data, uint32_t size, uint32_t flags);
+    bool openSegment(uint32_t id, Segment &segment, String *error);
+    std::shared_ptr<Mapping> mapping(Segment &segment);
+    void startCompaction();
+    void onCompactionFinished(uint32_t generation, uint32_t segment,
+                              const Hash<uint32_t, std::pair<uint32_t, uint32_t> > &moved,
+                              uint32_t tombstones, bool ok);
+
+    static String recordHeader(uint32_t fileId, uint32_t size, uint32_t flags);
+    static uint32_t align(uint32_t offset) { return ((offset + RecordAlignment - 1) / RecordAlignment) * RecordAlignment; }
+
+    const Path mDir;
+    Map<uint32_t, Segment> mSegments;
+    Hash<uint32_t, Entry> mEntries;
+    uint32_t mGeneration;
+    bool mCompacting;
+};
+
+#endif
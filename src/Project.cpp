@@ -15,16 +15,20 @@
 
 #include "Project.h"
 
+#include <ctype.h>
 #include <fnmatch.h>
 #include <memory>
 #include <regex>
+#include <set>
 
 #include "Diagnostic.h"
 #include "FileManager.h"
+#include "FuzzyMatch.h"
 #include "CompilerManager.h"
 #include "IndexDataMessage.h"
 #include "JobScheduler.h"
 #include "LogOutputMessage.h"
+#include "PackStore.h"
 #include "rct/DataFile.h"
 #include "rct/Log.h"
 #include "rct/MemoryMonitor.h"
@@ -38,7 +42,7 @@
 #include "Server.h"
 #include "RTagsVersion.h"
 
-enum { DirtyTimeout = 100, ReloadCompileCommandsTimeout = 500 };
+enum { DirtyTimeout = 100, ReloadCompileCommandsTimeout = 500, IndexRebuildTimeout = 0, IndexRebuildBatchSize = 32 };
 
 class Dirty
 {
@@ -258,10 +262,16 @@ static void saveDependencies(DataFile &file, const Dependencies &dependencies)
 
 Project::Project(const Path &path)
     : mPath(path), mProjectDataDir(RTags::encodeSourceFilePath(Server::instance()->options().dataDir, path)),
-      mJobCounter(0), mJobsStarted(0), mBytesWritten(0), mSaveDirty(false)
+      mJobCounter(0), mJobsStarted(0), mBytesWritten(0), mSaveDirty(false), mFileMapGeneration(0), mIndexGeneration(1)
 {
     mProjectFilePath = mProjectDataDir + "project";
     mSourcesFilePath = mProjectDataDir + "sources";
+    mUsrIndexFilePath = mProjectDataDir + "usrindex";
+    mSymbolNameIndexFilePath = mProjectDataDir + "symbolnameindex";
+    mUsrEdgesFilePath = mProjectDataDir + "usredges";
+    mCallGraphFilePath = mProjectDataDir + "callgraph";
+    mSymbolNameIndex = std::make_shared<SymbolNameIndex>();
+    mFileMapCache.maxSize = Server::instance()->options().fileMapCacheSize;
 }
 
 Project::~Project()
@@ -277,6 +287,7 @@ Project::~Project()
     assert(EventLoop::isMainThread());
     mDirtyTimer.stop();
     mReloadCompileCommandsTimer.stop();
+    mIndexRebuildTimer.stop();
 }
 
 static bool hasSourceDependency(const DependencyNode *node, const std::shared_ptr<Project> &project, Set<uint32_t> &seen)
@@ -339,6 +350,7 @@ bool Project::init()
 
     mDirtyTimer.timeout().connect(std::bind(&Project::onDirtyTimeout, this, std::placeholders::_1));
     mReloadCompileCommandsTimer.timeout().connect(std::bind(&Project::reloadCompileCommands, this));
+    mIndexRebuildTimer.timeout().connect(std::bind(&Project::onIndexRebuildTimeout, this, std::placeholders::_1));
 
     String err;
     if (!Project::readSources(mSourcesFilePath, mIndexParseData, &err)) {
@@ -348,6 +360,14 @@ bool Project::init()
         return false;
     }
 
+    if (options.options & Server::PackFileMaps) {
+        mPackStore = std::make_shared<PackStore>(mProjectDataDir + "pack/");
+        if (!mPackStore->load(&err)) {
+            error("Pack store restore error %s: %s", mPath.constData(), err.constData());
+            mPackStore->clear();
+        }
+    }
+
     auto reindexAll = [this]() {
         mProjectFilePath.visit([](const Path &path) {
                 if (strcmp(path.fileName(), "sources")) {
@@ -359,6 +379,8 @@ bool Project::init()
                 }
                 return Path::Continue;
             });
+        if (mPackStore)
+            mPackStore->clear();
         auto parseData = std::move(mIndexParseData);
         processParseData(std::move(parseData));
     };
@@ -388,11 +410,66 @@ bool Project::init()
         reindexAll();
         return true;
     }
+    file >> mFileMapGenerations >> mFileMapDigests >> mFileMapParseTimes >> mFileMapGeneration;
 
     for (const auto &dep : mDependencies) {
         watchFile(dep.first);
     }
 
+    {
+        DataFile usrIndex(mUsrIndexFilePath, RTags::DatabaseVersion);
+        if (usrIndex.open(DataFile::Read)) {
+            usrIndex >> mUsrFilters >> mTargetFilters >> mFileUsrs;
+            for (const auto &file : mFileUsrs) {
+                for (uint64_t hash : file.second)
+                    mUsrIndex[hash].insert(file.first);
+            }
+        } else if (!usrIndex.error().isEmpty()) {
+            warning("Couldn't restore usr index %s: %s", mPath.constData(), usrIndex.error().constData());
+        }
+    }
+
+    {
+        DataFile nameIndex(mSymbolNameIndexFilePath, RTags::DatabaseVersion);
+        bool ok = false;
+        if (nameIndex.open(DataFile::Read)) {
+            String data;
+            nameIndex >> data;
+            Deserializer deserializer(data);
+            ok = mSymbolNameIndex->decode(deserializer, data.size());
+        } else if (!nameIndex.error().isEmpty()) {
+            warning("Couldn't restore symbol name index %s: %s", mPath.constData(), nameIndex.error().constData());
+        }
+        if (!ok)
+            mSymbolNameIndex->clear();
+    }
+
+    {
+        DataFile usrEdges(mUsrEdgesFilePath, RTags::DatabaseVersion);
+        if (usrEdges.open(DataFile::Read)) {
+            usrEdges >> mSubclasses.files >> mOverrides.files;
+            mSubclasses.restore();
+            mOverrides.restore();
+        } else if (!usrEdges.error().isEmpty()) {
+            warning("Couldn't restore usr edges %s: %s", mPath.constData(), usrEdges.error().constData());
+        }
+    }
+
+    {
+        DataFile callGraph(mCallGraphFilePath, RTags::DatabaseVersion);
+        bool ok = false;
+        if (callGraph.open(DataFile::Read)) {
+            String data;
+            callGraph >> data;
+            Deserializer deserializer(data);
+            ok = mCallGraph.decode(deserializer, data.size());
+        } else if (!callGraph.error().isEmpty()) {
+            warning("Couldn't restore call graph %s: %s", mPath.constData(), callGraph.error().constData());
+        }
+        if (!ok)
+            mCallGraph.clear();
+    }
+
     bool needsSave = false;
     std::unique_ptr<ComplexDirty> dirty;
 
@@ -455,6 +532,11 @@ bool Project::init()
         }
     }
 
+    // Whatever the indexes are missing, because they couldn't be restored or
+    // because files were indexed after they were saved, is added in the
+    // background. Until then queries open the file maps instead.
+    scheduleIndexRebuild();
+
     forEachSourceList([&dirty, this, &needsSave](SourceList &src) -> VisitResult {
             uint32_t fileId = src.fileId();
             const Path sourceFile = Location::path(fileId);
@@ -750,15 +832,66 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job, const std::s
         error() << "Can't find source for" << Location::path(fileId);
         return;
     }
+    // files whose maps rp found identical to what we have keep their
+    // generation and don't need to be validated again
+    const Hash<uint32_t, uint32_t> &unchanged = msg->unchangedFileMaps();
+    Set<uint32_t> changed;
+    for (uint32_t file : job->visited) {
+        if (!unchanged.contains(file)) {
+            changed.insert(file);
+            mFileMapCache.remove(file);
+        }
+    }
     if (!(msg->flags() & IndexDataMessage::ParseFailure)) {
+        // switch to the new generation, the previous one stays on disk until
+        // the new one has been validated
+        Hash<uint32_t, uint32_t> previous;
+        bool stale = false;
+        invalidateIndexes();
         for (uint32_t file : job->visited) {
-            if (!validate(file, Validate)) {
-                releaseFileIds(job->visited);
-                dirty(fileId);
-                return;
+            previous[file] = mFileMapGenerations.value(file);
+            if (changed.contains(file)) {
+                mFileMapGenerations[file] = msg->fileMapGeneration();
+            } else if (unchanged.value(file) != previous[file]) {
+                // another job replaced the maps rp compared against
+                stale = true;
+            }
+        }
+        bool ok = !stale;
+        for (auto it = changed.begin(); ok && it != changed.end(); ++it)
+            ok = validate(*it, Validate);
+        if (!ok) {
+            for (const auto &prev : previous) {
+                if (prev.second) {
+                    mFileMapGenerations[prev.first] = prev.second;
+                } else {
+                    mFileMapGenerations.remove(prev.first);
+                }
             }
+            releaseFileIds(job->visited);
+            dirty(fileId);
+            return;
         }
+        // unchanged maps are just as current as the ones that were written
+        for (uint32_t file : job->visited)
+            mFileMapParseTimes[file] = msg->parseTime();
+        // only pack maps that passed, the pack keeps serving the previous
+        // record until then
+        if (mPackStore) {
+            for (uint32_t file : changed)
+                packFileMaps(file);
+        }
+        for (uint32_t file : changed) {
+            mFileMapDigests[file] = msg->fileMapDigests().value(file);
+            removeStaleFileMaps(file);
+            updateUsrIndex(file);
+            updateUsrEdges(file);
+            updateCallGraph(file);
+        }
+        updateSymbolNameIndex(changed);
     }
+    // on a parse failure the previous generation's maps are still the
+    // current ones and so are the project indexes built from them
 
     const int idx = mJobCounter - mActiveJobs.size();
     updateDiagnostics(fileId, msg->diagnostics());
@@ -909,11 +1042,66 @@ bool Project::save()
         }
         file << mDiagnostics;
         saveDependencies(file, mDependencies);
+        file << mFileMapGenerations << mFileMapDigests << mFileMapParseTimes << mFileMapGeneration;
         if (!file.flush()) {
             error("Save error %s: %s", mProjectFilePath.constData(), file.error().constData());
             return false;
         }
     }
+    {
+        DataFile file(mUsrIndexFilePath, RTags::DatabaseVersion);
+        if (!file.open(DataFile::Write)) {
+            error("Save error %s: %s", mUsrIndexFilePath.constData(), file.error().constData());
+            return false;
+        }
+        file << mUsrFilters << mTargetFilters << mFileUsrs;
+        if (!file.flush()) {
+            error("Save error %s: %s", mUsrIndexFilePath.constData(), file.error().constData());
+            return false;
+        }
+    }
+    {
+        DataFile file(mSymbolNameIndexFilePath, RTags::DatabaseVersion);
+        if (!file.open(DataFile::Write)) {
+            error("Save error %s: %s", mSymbolNameIndexFilePath.constData(), file.error().constData());
+            return false;
+        }
+        String data;
+        Serializer serializer(data);
+        mSymbolNameIndex->encode(serializer);
+        file << data;
+        if (!file.flush()) {
+            error("Save error %s: %s", mSymbolNameIndexFilePath.constData(), file.error().constData());
+            return false;
+        }
+    }
+    {
+        DataFile file(mUsrEdgesFilePath, RTags::DatabaseVersion);
+        if (!file.open(DataFile::Write)) {
+            error("Save error %s: %s", mUsrEdgesFilePath.constData(), file.error().constData());
+            return false;
+        }
+        file << mSubclasses.files << mOverrides.files;
+        if (!file.flush()) {
+            error("Save error %s: %s", mUsrEdgesFilePath.constData(), file.error().constData());
+            return false;
+        }
+    }
+    {
+        DataFile file(mCallGraphFilePath, RTags::DatabaseVersion);
+        if (!file.open(DataFile::Write)) {
+            error("Save error %s: %s", mCallGraphFilePath.constData(), file.error().constData());
+            return false;
+        }
+        String data;
+        Serializer serializer(data);
+        mCallGraph.encode(serializer);
+        file << data;
+        if (!file.flush()) {
+            error("Save error %s: %s", mCallGraphFilePath.constData(), file.error().constData());
+            return false;
+        }
+    }
     mSaveDirty = false;
     return true;
 }
@@ -1085,6 +1273,16 @@ bool Project::dependsOn(uint32_t source, uint32_t header) const
 void Project::removeDependencies(uint32_t fileId)
 {
     // error() << "removeDependencies" << Location::path(fileId);
+    removeUsrIndex(fileId);
+    removeUsrEdges(fileId);
+    mCallGraph.remove(fileId);
+    mSymbolNameIndex->remove(fileId);
+    mFileMapCache.remove(fileId);
+    mFileMapGenerations.remove(fileId);
+    mFileMapDigests.remove(fileId);
+    mFileMapParseTimes.remove(fileId);
+    if (mPackStore)
+        mPackStore->remove(fileId);
     if (DependencyNode *node = mDependencies.take(fileId)) {
         for (auto it : node->includes)
             it.second->dependents.remove(fileId);
@@ -1094,9 +1292,260 @@ void Project::removeDependencies(uint32_t fileId)
     }
 }
 
+void Project::removeUsrIndex(uint32_t fileId)
+{
+    invalidateIndexes();
+    mUsrFilters.remove(fileId);
+    mTargetFilters.remove(fileId);
+    for (uint64_t hash : mFileUsrs.take(fileId)) {
+        auto it = mUsrIndex.find(hash);
+        if (it != mUsrIndex.end()) {
+            it->second.remove(fileId);
+            if (it->second.isEmpty())
+                mUsrIndex.erase(it);
+        }
+    }
+}
+
+void Project::updateUsrIndex(uint32_t fileId)
+{
+    removeUsrIndex(fileId);
+    auto container = openFileMaps(fileId);
+    if (!container)
+        return;
+    auto update = [this, fileId, &container](FileMapType type, Hash<uint32_t, BloomFilter> &filters) {
+        FileMap<uint64_t, Set<Location> > fileMap;
+        FileMap<String, Set<Location> > collisions;
+        if (!container->open(type, fileMap)
+            || !container->open(type == Usrs ? UsrCollisions : TargetCollisions, collisions)) {
+            return false;
+        }
+        const uint32_t count = fileMap.count();
+        const uint32_t collisionCount = collisions.count();
+        BloomFilter filter(count + collisionCount);
+        List<uint64_t> hashes;
+        if (type == Usrs)
+            hashes.reserve(count + collisionCount);
+        FileMap<String, Set<Location> >::KeyCursor cursor;
+        for (uint32_t i=0; i<count + collisionCount; ++i) {
+            uint64_t hash;
+            if (i < count) {
+                hash = fileMap.keyAt(i);
+            } else {
+                const FileMapString key = collisions.keyView(i - count, cursor);
+                hash = RTags::hashUsr(key.data(), key.size());
+            }
+            filter.insert(hash);
+            if (type == Usrs)
+                hashes.append(hash);
+        }
+        filters[fileId] = std::move(filter);
+        if (type == Usrs) {
+            for (uint64_t hash : hashes)
+                mUsrIndex[hash].insert(fileId);
+            mFileUsrs[fileId] = std::move(hashes);
+        }
+        return true;
+    };
+    if (!update(Usrs, mUsrFilters) || !update(Targets, mTargetFilters))
+        removeUsrIndex(fileId);
+}
+
+void Project::UsrEdges::insert(uint32_t fileId, const FileMap<String, Set<Location> > &fileMap)
+{
+    remove(fileId);
+    List<std::pair<uint64_t, Location> > &list = files[fileId];
+    const uint32_t count = fileMap.count();
+    FileMap<String, Set<Location> >::KeyCursor cursor;
+    for (uint32_t i=0; i<count; ++i) {
+        const FileMapString usr = fileMap.keyView(i, cursor);
+        const uint64_t hash = RTags::hashUsr(usr.data(), usr.size());
+        for (Location location : fileMap.valueAt(i)) {
+            list.append(std::make_pair(hash, location));
+            edges[hash].insert(location);
+        }
+    }
+}
+
+void Project::UsrEdges::remove(uint32_t fileId)
+{
+    for (const auto &edge : files.take(fileId)) {
+        auto it = edges.find(edge.first);
+        if (it != edges.end()) {
+            it->second.remove(edge.second);
+            if (it->second.isEmpty())
+                edges.erase(it);
+        }
+    }
+}
+
+void Project::UsrEdges::restore()
+{
+    edges.clear();
+    for (const auto &file : files) {
+        for (const auto &edge : file.second)
+            edges[edge.first].insert(edge.second);
+    }
+}
+
+void Project::removeUsrEdges(uint32_t fileId)
+{
+    invalidateIndexes();
+    mSubclasses.remove(fileId);
+    mOverrides.remove(fileId);
+}
+
+void Project::updateUsrEdges(uint32_t fileId)
+{
+    removeUsrEdges(fileId);
+    auto container = openFileMaps(fileId);
+    FileMap<String, Set<Location> > subclasses, overrides;
+    if (!container || !container->open(Subclasses, subclasses) || !container->open(Overrides, overrides))
+        return;
+    mSubclasses.insert(fileId, subclasses);
+    mOverrides.insert(fileId, overrides);
+}
+
+void Project::updateCallGraph(uint32_t fileId)
+{
+    invalidateIndexes();
+    mCallGraph.remove(fileId);
+    auto container = openFileMaps(fileId);
+    FileMap<String, Set<Location> > callers, callees;
+    if (!container || !container->open(Callers, callers) || !container->open(Callees, callees))
+        return;
+    mCallGraph.insert(fileId, callers, callees);
+}
+
+bool Project::indexContains(ProjectIndex index, uint32_t fileId) const
+{
+    switch (index) {
+    case UsrIndex: return mFileUsrs.contains(fileId);
+    case NameIndex: return mSymbolNameIndex->contains(fileId);
+    case SubclassIndex: return mSubclasses.files.contains(fileId);
+    case OverrideIndex: return mOverrides.files.contains(fileId);
+    case CallGraphIndex: return mCallGraph.contains(fileId);
+    case ProjectIndexCount: break;
+    }
+    assert(0);
+    return false;
+}
+
+bool Project::isComplete(ProjectIndex index) const
+{
+    IndexCoverage &coverage = mIndexCoverage[index];
+    if (coverage.generation != mIndexGeneration) {
+        coverage.generation = mIndexGeneration;
+        coverage.complete = true;
+        for (const auto &dep : mDependencies) {
+            // files without maps have nothing to add to a query either way
+            if (!indexContains(index, dep.first) && mFileMapGenerations.contains(dep.first)) {
+                coverage.complete = false;
+                break;
+            }
+        }
+    }
+    return coverage.complete;
+}
+
+void Project::scheduleIndexRebuild()
+{
+    for (const auto &dep : mDependencies) {
+        if (!mFileMapGenerations.contains(dep.first))
+            continue;
+        for (int i=0; i<ProjectIndexCount; ++i) {
+            if (!indexContains(static_cast<ProjectIndex>(i), dep.first)) {
+                mIndexRebuildFiles.insert(dep.first);
+                break;
+            }
+        }
+    }
+    if (!mIndexRebuildFiles.isEmpty()) {
+        warning() << "Rebuilding the indexes of" << mIndexRebuildFiles.size() << "files in" << mPath;
+        mIndexRebuildTimer.restart(IndexRebuildTimeout, Timer::SingleShot);
+    }
+}
+
+void Project::onIndexRebuildTimeout(Timer *)
+{
+    // a few files at a time so queries and jobs aren't held up
+    Set<uint32_t> names;
+    for (int i=0; i<IndexRebuildBatchSize && !mIndexRebuildFiles.isEmpty(); ++i) {
+        const uint32_t fileId = *mIndexRebuildFiles.begin();
+        mIndexRebuildFiles.erase(mIndexRebuildFiles.begin());
+        // files that were indexed or removed since are up to date
+        if (!mFileMapGenerations.contains(fileId))
+            continue;
+        if (!indexContains(UsrIndex, fileId))
+            updateUsrIndex(fileId);
+        if (!indexContains(SubclassIndex, fileId) || !indexContains(OverrideIndex, fileId))
+            updateUsrEdges(fileId);
+        if (!indexContains(CallGraphIndex, fileId))
+            updateCallGraph(fileId);
+        if (!indexContains(NameIndex, fileId))
+            names.insert(fileId);
+    }
+    if (!names.isEmpty())
+        updateSymbolNameIndex(names);
+    if (!mIndexRebuildFiles.isEmpty()) {
+        mIndexRebuildTimer.restart(IndexRebuildTimeout, Timer::SingleShot);
+    } else {
+        mSaveDirty = true;
+    }
+}
+
+void Project::updateSymbolNameIndex(const Set<uint32_t> &files)
+{
+    invalidateIndexes();
+    Hash<uint32_t, List<String> > names;
+    for (uint32_t fileId : files) {
+        auto container = openFileMaps(fileId);
+        FileMap<String, Set<Location> > symbolNames;
+        SymbolNameSuffixes suffixes;
+        if (!container || !container->open(SymbolNames, symbolNames) || !container->open(SymbolSuffixes, suffixes)) {
+            mSymbolNameIndex->remove(fileId);
+            continue;
+        }
+        List<String> &list = names[fileId];
+        const uint32_t count = symbolNames.count();
+        const uint32_t suffixCount = suffixes.count();
+        list.reserve(count + suffixCount);
+        for (uint32_t i=0; i<count; ++i)
+            list.append(symbolNames.keyAt(i));
+        String buffer;
+        for (uint32_t i=0; i<suffixCount; ++i)
+            list.append(suffixes.view(symbolNames, i, buffer).toString());
+    }
+    mSymbolNameIndex->insert(names);
+}
+
+Set<Location> Project::symbolNameLocations(uint32_t fileId, const String &name)
+{
+    Set<Location> ret;
+    auto symNames = openSymbolNames(fileId);
+    if (!symNames)
+        return ret;
+    ret = symNames->value(name);
+    if (auto suffixes = openSymbolNameSuffixes(fileId)) {
+        String buffer;
+        const uint32_t count = suffixes->count();
+        for (uint32_t i=suffixes->lowerBound(*symNames, name); i<count && suffixes->view(*symNames, i, buffer) == name; ++i)
+            ret.unite(symNames->valueAt(suffixes->at(i).name));
+    }
+    return ret;
+}
+
+bool Project::mightContainUsr(FileMapType type, uint32_t fileId, uint64_t usrHash) const
+{
+    const Hash<uint32_t, BloomFilter> &filters = type == Usrs ? mUsrFilters : mTargetFilters;
+    const auto it = filters.find(fileId);
+    return it == filters.end() || it->second.mightContain(usrHash);
+}
+
 void Project::updateDependencies(uint32_t fileId, const std::shared_ptr<IndexDataMessage> &msg)
 {
     static_cast<void>(fileId);
+    invalidateIndexes();
     const bool prune = !(msg->flags() & (IndexDataMessage::InclusionError|IndexDataMessage::ParseFailure));
     // error() << "updateDependencies" << Location::path(fileId) << prune;
     Set<uint32_t> includeErrors, dirty;
@@ -1410,12 +1859,104 @@ String Project::fixIts(uint32_t fileId) const
     return out;
 }
 
+// the parts of a wildcard pattern between the * and ? characters
+static List<String> wildcardLiterals(const String &pattern)
+{
+    List<String> ret(1);
+    const size_t size = pattern.size();
+    for (size_t i=0; i<size; ++i) {
+        const char ch = pattern.at(i);
+        if (ch == '*' || ch == '?') {
+            if (!ret.last().isEmpty())
+                ret.append(String());
+        } else {
+            ret.last().append(ch);
+        }
+    }
+    return ret;
+}
+
+/*
+ * Strings that have to be in anything the regex matches. This is
+ * conservative, alternations give up and groups, classes and anything made
+ * optional by a quantifier end the current string.
+ */
+static List<String> regexLiterals(const String &pattern)
+{
+    List<String> ret;
+    if (pattern.contains('|'))
+        return ret;
+    String current;
+    auto flush = [&ret, &current]() {
+        if (current.size() >= 3)
+            ret.append(current);
+        current.clear();
+    };
+    const size_t size = pattern.size();
+    for (size_t i=0; i<size; ++i) {
+        const char ch = pattern.at(i);
+        switch (ch) {
+        case '\\':
+            if (i + 1 < size && !isalnum(static_cast<unsigned char>(pattern.at(i + 1)))) {
+                current.append(pattern.at(++i));
+            } else {
+                ++i;
+                flush();
+            }
+            break;
+        case '?':
+        case '*':
+        case '{':
+            // the previous character is optional
+            if (!current.isEmpty())
+                current.chop(1);
+            flush();
+            if (ch == '{') {
+                while (i < size && pattern.at(i) != '}')
+                    ++i;
+            }
+            break;
+        case '(':
+        case '[': {
+            flush();
+            const char close = ch == '(' ? ')' : ']';
+            int depth = 0;
+            for (; i<size; ++i) {
+                if (pattern.at(i) == '\\') {
+                    ++i;
+                } else if (pattern.at(i) == ch) {
+                    ++depth;
+                } else if (pattern.at(i) == close && !--depth) {
+                    break;
+                }
+            }
+            break; }
+        case '+':
+        case '.':
+        case '^':
+        case '$':
+            flush();
+            break;
+        default:
+            current.append(ch);
+            break;
+        }
+    }
+    flush();
+    return ret;
+}
+
 void Project::findSymbols(const String &unencoded,
                           const std::function<void(SymbolMatchType, const String &, const Set<Location> &)> &inserter,
                           Flags<QueryMessage::Flag> queryFlags,
-                          uint32_t fileFilter)
+                          uint32_t fileFilter,
+                          int max)
 {
     const String string = Sandbox::encoded(unencoded);
+    if (queryFlags & QueryMessage::MatchFuzzy) {
+        findFuzzySymbols(string, inserter, fileFilter, max);
+        return;
+    }
     const bool wildcard = queryFlags & QueryMessage::WildcardSymbolNames && (string.contains('*') || string.contains('?'));
     const bool caseInsensitive = queryFlags & QueryMessage::MatchCaseInsensitive;
     std::regex rx;
@@ -1438,57 +1979,203 @@ void Project::findSymbols(const String &unencoded,
         lowerBound = string;
     }
 
-    auto processFile = [this, &lowerBound, &string, wildcard, regex, &rx, cs, &inserter](uint32_t file) {
+    // returns 1 for a match, 0 for no match and -1 when no later entry can match
+    auto match = [&string, &lowerBound, wildcard, regex, &rx, cs](const FileMapString &entry, String &buffer, SymbolMatchType &type) -> int {
+        type = Exact;
+        if (string.isEmpty())
+            return 1;
+        if (wildcard) {
+            // the names are sorted, past the literal prefix nothing matches
+            if (!lowerBound.isEmpty() && !entry.startsWith(lowerBound))
+                return -1;
+            // wildCmp needs a null terminated string
+            if (entry.data() != buffer.constData())
+                buffer.ref().assign(entry.data(), entry.size());
+            if (!Rct::wildCmp(string.constData(), buffer.constData(), cs))
+                return 0;
+            type = Wildcard;
+        } else if (regex) {
+            if (!std::regex_search(entry.data(), entry.data() + entry.size(), rx))
+                return 0;
+            type = Regexp;
+        } else if (!entry.startsWith(string, cs)) {
+            return cs == String::CaseInsensitive ? 0 : -1;
+        } else if (entry.size() != string.size()) {
+            type = StartsWith;
+        }
+        return 1;
+    };
+
+    auto processFile = [this, &lowerBound, &match, &inserter](uint32_t file) {
         auto symNames = openSymbolNames(file);
         if (!symNames)
             return;
-        const int count = symNames->count();
+        String buffer;
+        SymbolMatchType type;
+        const uint32_t count = symNames->count();
         // error() << "Looking at" << count << Location::path(dep.first)
         //         << lowerBound << string;
         uint32_t idx = 0;
-        if (!lowerBound.isEmpty()) {
-            idx = symNames->lowerBound(lowerBound);
-            if (idx == std::numeric_limits<uint32_t>::max()) {
+        if (!lowerBound.isEmpty())
+            idx = std::min(symNames->lowerBound(lowerBound), count);
+
+        FileMap<String, Set<Location> >::KeyCursor cursor;
+        for (uint32_t i=idx; i<count; ++i) {
+            const FileMapString entry = symNames->keyView(i, cursor);
+            // error() << i << count << entry;
+            const int matched = match(entry, buffer, type);
+            if (matched < 0)
+                break;
+            if (matched)
+                inserter(type, entry.toString(), symNames->valueAt(i));
+        }
+
+        // the less qualified names
+        auto suffixes = openSymbolNameSuffixes(file);
+        if (!suffixes)
+            return;
+        const uint32_t suffixCount = suffixes->count();
+        for (uint32_t i=lowerBound.isEmpty() ? 0 : suffixes->lowerBound(*symNames, lowerBound); i<suffixCount; ++i) {
+            const FileMapString entry = suffixes->view(*symNames, i, buffer);
+            const int matched = match(entry, buffer, type);
+            if (matched < 0)
+                break;
+            if (matched)
+                inserter(type, entry.toString(), symNames->valueAt(suffixes->at(i).name));
+        }
+    };
+
+    if (fileFilter) {
+        processFile(fileFilter);
+    } else if (isComplete(NameIndex)) {
+        // every file is in the name index, only open the ones with matches
+        String buffer;
+        SymbolMatchType type;
+        auto visitor = [this, &match, &inserter, &buffer, &type](const FileMapString &name, uint32_t file) -> int {
+            const int matched = match(name, buffer, type);
+            if (matched > 0) {
+                const String str = name.toString();
+                const Set<Location> locations = symbolNameLocations(file, str);
+                if (!locations.isEmpty())
+                    inserter(type, str, locations);
+            }
+            return matched;
+        };
+        if (!lowerBound.isEmpty() || (!caseInsensitive && !regex && !wildcard)) {
+            mSymbolNameIndex->find(lowerBound, visitor);
+        } else if (!regex && (!wildcard || (string.at(0) != '*' && string.at(0) != '?'))) {
+            mSymbolNameIndex->findCaseInsensitive(wildcard ? ::wildcardLiterals(string).front() : string, visitor);
+        } else {
+            // the trigrams of the parts that have to be in every match
+            mSymbolNameIndex->findSubstrings(regex ? ::regexLiterals(string) : ::wildcardLiterals(string), visitor);
+        }
+    } else {
+        for (const auto &dep : mDependencies) {
+            processFile(dep.first);
+        }
+    }
+}
+
+void Project::findFuzzySymbols(const String &query,
+                               const std::function<void(SymbolMatchType, const String &, const Set<Location> &)> &inserter,
+                               uint32_t fileFilter, int max)
+{
+    const FuzzyMatch fuzzy(query);
+    struct Candidate {
+        int score;
+        String name;
+        Location location; // the first of locations, one entry per symbol
+        Set<Location> locations;
+
+        bool operator<(const Candidate &other) const
+        {
+            if (score != other.score)
+                return score > other.score;
+            const int cmp = name.compare(other.name);
+            return cmp < 0 || (!cmp && location < other.location);
+        }
+    };
+    // the best max candidates, best first. Most symbols have several names
+    // (see SymbolNameSuffixes), only the best one of each is kept
+    std::set<Candidate> best;
+    Map<Location, std::set<Candidate>::const_iterator> symbols;
+    const size_t limit = max > 0 ? max : std::numeric_limits<size_t>::max();
+
+    // whether a candidate with this score and name would make it into best
+    auto beats = [&best, limit](int score, const FileMapString &name) -> bool {
+        if (best.size() < limit)
+            return true;
+        const Candidate &worst = *best.rbegin();
+        return score > worst.score || (score == worst.score && name.compare(worst.name) <= 0);
+    };
+    auto add = [&best, &symbols, limit](int score, String &&name, Set<Location> &&locations) {
+        if (locations.isEmpty())
+            return;
+        const Location key = *locations.begin();
+        Candidate candidate = { score, std::move(name), key, std::move(locations) };
+        const auto it = symbols.find(key);
+        if (it != symbols.end()) {
+            if (!(candidate < *it->second))
                 return;
-            }
+            best.erase(it->second);
+        }
+        symbols[key] = best.insert(std::move(candidate)).first;
+        if (best.size() > limit) {
+            const auto worst = std::prev(best.end());
+            symbols.remove(worst->location);
+            best.erase(worst);
         }
+    };
 
-        for (int i=idx; i<count; ++i) {
-            const String entry = symNames->keyAt(i);
-            // error() << i << count << entry;
-            SymbolMatchType type = Exact;
-            if (!string.isEmpty()) {
-                if (wildcard) {
-                    if (!Rct::wildCmp(string.constData(), entry.constData(), cs)) {
-                        continue;
-                    }
-                    type = Wildcard;
-                } else if (regex) {
-                    if (!std::regex_search(entry.ref(), rx)) {
-                        continue;
-                    }
-                    type = Regexp;
-                } else if (!entry.startsWith(string, cs)) {
-                    if (cs == String::CaseInsensitive) {
-                        continue;
-                    } else {
-                        break;
-                    }
-                } else if (entry.size() != string.size()) {
-                    type = StartsWith;
-                }
-            }
-            inserter(type, entry, symNames->valueAt(i));
+    int score;
+    auto processFile = [this, &fuzzy, &beats, &add, &score](uint32_t file) {
+        auto symNames = openSymbolNames(file);
+        if (!symNames)
+            return;
+        const uint32_t count = symNames->count();
+        FileMap<String, Set<Location> >::KeyCursor cursor;
+        for (uint32_t i=0; i<count; ++i) {
+            const FileMapString name = symNames->keyView(i, cursor);
+            if (fuzzy.score(name, score) && beats(score, name))
+                add(score, name.toString(), symNames->valueAt(i));
+        }
+
+        auto suffixes = openSymbolNameSuffixes(file);
+        if (!suffixes)
+            return;
+        String buffer;
+        const uint32_t suffixCount = suffixes->count();
+        for (uint32_t i=0; i<suffixCount; ++i) {
+            const FileMapString name = suffixes->view(*symNames, i, buffer);
+            if (fuzzy.score(name, score) && beats(score, name))
+                add(score, name.toString(), symNames->valueAt(suffixes->at(i).name));
         }
     };
 
     if (fileFilter) {
         processFile(fileFilter);
+    } else if (isComplete(NameIndex)) {
+        // shortest names first, once best is full and no name of this size
+        // can beat the worst one we're done
+        auto visitor = [this, &fuzzy, &best, limit, &beats, &add, &score](const FileMapString &name, uint32_t file) -> int {
+            if (best.size() >= limit && fuzzy.maxScore(name.size()) < best.rbegin()->score)
+                return -1;
+            if (fuzzy.score(name, score) && beats(score, name)) {
+                String str = name.toString();
+                Set<Location> locations = symbolNameLocations(file, str);
+                add(score, std::move(str), std::move(locations));
+            }
+            return 0;
+        };
+        mSymbolNameIndex->findBySize(SymbolNameIndex::characters(fuzzy.query().constData(), fuzzy.query().size()), visitor);
     } else {
         for (const auto &dep : mDependencies) {
             processFile(dep.first);
         }
     }
+
+    for (const Candidate &candidate : best)
+        inserter(Fuzzy, candidate.name, candidate.locations);
 }
 
 List<RTags::SortedSymbol> Project::sort(const Set<Symbol> &symbols, Flags<QueryMessage::Flag> flags)
@@ -1601,22 +2288,14 @@ String Project::toCompileCommands() const
     return ret.toJSON(true);
 }
 
-Symbol Project::findSymbol(Location location, int *index)
+// idx and exact are what lowerBound() returned for location
+static Symbol symbolAt(const std::shared_ptr<FileMap<Location, Symbol> > &symbols, Location location,
+                       uint32_t idx, bool exact, int *index, uint32_t columns)
 {
-    if (index)
-        *index = -1;
-    if (location.isNull())
-        return Symbol();
-    auto symbols = openSymbols(location.fileId());
-    if (!symbols || !symbols->count())
-        return Symbol();
-
-    bool exact = false;
-    uint32_t idx = symbols->lowerBound(location, &exact);
     if (exact) {
         if (index)
             *index = idx;
-        return symbols->valueAt(idx);
+        return symbols->valueAt(idx, columns);
     }
     switch (idx) {
     case 0:
@@ -1629,7 +2308,7 @@ Symbol Project::findSymbol(Location location, int *index)
         break;
     }
 
-    const Symbol &ret = symbols->valueAt(idx);
+    const Symbol &ret = symbols->valueAt(idx, columns);
     if (ret.location.fileId() != location.fileId()
         || ret.location.line() != location.line()
         || (location.column() - ret.location.column() >= ret.symbolLength)) {
@@ -1640,6 +2319,59 @@ Symbol Project::findSymbol(Location location, int *index)
     return ret;
 }
 
+Symbol Project::findSymbol(Location location, int *index, uint32_t columns)
+{
+    columns |= Symbol::Hot;
+    if (index)
+        *index = -1;
+    if (location.isNull())
+        return Symbol();
+    auto symbols = openSymbols(location.fileId());
+    if (!symbols || !symbols->count())
+        return Symbol();
+
+    bool exact = false;
+    const uint32_t idx = symbols->lowerBound(location, &exact);
+    return symbolAt(symbols, location, idx, exact, index, columns);
+}
+
+List<Symbol> Project::findSymbols(const Set<Location> &locations, List<int> *indexes, uint32_t columns)
+{
+    columns |= Symbol::Hot;
+    const size_t count = locations.size();
+    List<Symbol> ret(count);
+    if (indexes)
+        *indexes = List<int>(count, -1);
+    if (!count)
+        return ret;
+
+    List<Location> keys;
+    keys.reserve(count);
+    for (Location loc : locations)
+        keys.append(loc);
+    List<uint32_t> idx(count);
+    std::unique_ptr<bool[]> exact(new bool[count]);
+
+    // the set is sorted by file first so each file's locations are a range
+    size_t start = 0;
+    while (start < count) {
+        const uint32_t fileId = keys.at(start).fileId();
+        size_t end = start + 1;
+        while (end < count && keys.at(end).fileId() == fileId)
+            ++end;
+        auto symbols = fileId ? openSymbols(fileId) : std::shared_ptr<FileMap<Location, Symbol> >();
+        if (symbols && symbols->count()) {
+            symbols->lowerBounds(keys.data() + start, end - start, idx.data() + start, exact.get() + start);
+            for (size_t i=start; i<end; ++i) {
+                ret[i] = symbolAt(symbols, keys.at(i), idx.at(i), exact[i],
+                                  indexes ? &(*indexes)[i] : 0, columns);
+            }
+        }
+        start = end;
+    }
+    return ret;
+}
+
 Set<Symbol> Project::findTargets(const Symbol &symbol)
 {
     Set<Symbol> ret;
@@ -1695,25 +2427,80 @@ Set<Symbol> Project::findTargets(const Symbol &symbol)
     return ret;
 }
 
+Set<Location> Project::usrLocations(FileMapType type, uint32_t fileId, const String &usr, uint64_t hash)
+{
+    assert(type == Usrs || type == Targets);
+    assert(hash == RTags::hashUsr(usr));
+    // colliding usrs are never in the hashed map, but a usr that isn't in
+    // this file at all can share its hash with one that is so a hit is
+    // checked against the usr names
+    auto collisions = type == Usrs ? openUsrCollisions(fileId) : openTargetCollisions(fileId);
+    if (collisions && collisions->count()) {
+        bool matched;
+        Set<Location> ret = collisions->value(usr, &matched);
+        if (matched)
+            return ret;
+    }
+    auto fileMap = type == Usrs ? openUsrs(fileId) : openTargets(fileId);
+    if (!fileMap)
+        return Set<Location>();
+    bool matched;
+    Set<Location> ret = fileMap->value(hash, &matched);
+    if (matched) {
+        auto names = openUsrNames(fileId);
+        if (!names || names->value(hash) != usr)
+            return Set<Location>();
+    }
+    return ret;
+}
+
+String Project::targetUsrAt(uint32_t fileId, uint32_t index)
+{
+    auto targets = openTargets(fileId);
+    if (!targets)
+        return String();
+    if (index < targets->count()) {
+        auto names = openUsrNames(fileId);
+        return names ? names->value(targets->keyAt(index)) : String();
+    }
+    auto collisions = openTargetCollisions(fileId);
+    index -= targets->count();
+    if (!collisions || index >= collisions->count())
+        return String();
+    return collisions->keyAt(index);
+}
+
 Set<Symbol> Project::findByUsr(const String &usr, uint32_t fileId, DependencyMode mode)
 {
     assert(fileId);
     Set<Symbol> ret;
     String tusr = Sandbox::encoded(usr);
-    for (uint32_t file : dependencies(fileId, mode)) {
-        auto usrs = openUsrs(file);
-        // error() << usrs << Location::path(file) << usr;
-        if (usrs) {
-            // SBROOT
-            for (Location loc : usrs->value(tusr)) {
-                // error() << "got a loc" << loc;
-                const Symbol c = findSymbol(loc);
-                if (!c.isNull())
-                    ret.insert(c);
+    const uint64_t hash = RTags::hashUsr(tusr);
+    auto process = [this, &tusr, hash, &ret](uint32_t file) {
+        // SBROOT
+        for (const Symbol &c : findSymbols(usrLocations(Usrs, file, tusr, hash))) {
+            // error() << "got a symbol" << c.location;
+            if (!c.isNull())
+                ret.insert(c);
+        }
+    };
+
+    if (isComplete(UsrIndex)) {
+        // every file is in the usr index, only look at the ones that have this usr
+        const auto it = mUsrIndex.find(hash);
+        if (it != mUsrIndex.end()) {
+            for (uint32_t file : it->second) {
+                if (mode == All
+                    || file == fileId
+                    || (mode == ArgDependsOn ? dependsOn(fileId, file) : dependsOn(file, fileId))) {
+                    process(file);
+                }
             }
-            // for (int i=0; i<usrs->count(); ++i) {
-            //     error() << i << usrs->count() << usrs->keyAt(i) << usrs->valueAt(i);
-            // }
+        }
+    } else {
+        for (uint32_t file : dependencies(fileId, mode)) {
+            if (mightContainUsr(Usrs, file, hash))
+                process(file);
         }
     }
 
@@ -1735,18 +2522,32 @@ static Set<Symbol> findReferences(const Set<Symbol> &inputs,
     // const bool isClazz = s.isClass();
     for (const Symbol &input : inputs) {
         //warning() << "Calling findReferences" << input.location;
+        // SBROOT
+        const String tusr = Sandbox::encoded(input.usr);
+        const uint64_t hash = RTags::hashUsr(tusr);
         auto process = [&](uint32_t dep) {
             // error() << "Looking at file" << Location::path(dep) << "for input" << input.location;
-            auto targets = project->openTargets(dep);
-            if (targets) {
-                // SBROOT
-                const String tusr = Sandbox::encoded(input.usr);
-                const Set<Location> locations = targets->value(tusr);
-                // error() << "Got locations for usr" << input.usr << locations;
-                for (const auto &loc : locations) {
-                    auto sym = project->findSymbol(loc);
-                    if (filter(input, sym))
+            if (!project->mightContainUsr(Project::Targets, dep, hash))
+                return;
+            const Set<Location> locations = project->usrLocations(Project::Targets, dep, tusr, hash);
+            // error() << "Got locations for usr" << input.usr << locations;
+            // the filters only look at the hot columns, read the rest for the ones we keep
+            List<int> indexes;
+            const List<Symbol> symbols = project->findSymbols(locations, &indexes, Symbol::Hot);
+            Hash<uint32_t, std::shared_ptr<FileMap<Location, Symbol> > > maps;
+            for (size_t i=0; i<symbols.size(); ++i) {
+                const Symbol &sym = symbols.at(i);
+                if (filter(input, sym)) {
+                    if (indexes.at(i) == -1) {
                         ret.insert(sym);
+                        continue;
+                    }
+                    // the map may have been evicted since and fail to open again
+                    const uint32_t fileId = sym.location.fileId();
+                    if (!maps.contains(fileId))
+                        maps[fileId] = project->openSymbols(fileId);
+                    if (const auto &map = maps[fileId])
+                        ret.insert(map->valueAt(indexes.at(i)));
                 }
             }
         };
@@ -1867,6 +2668,61 @@ Set<Symbol> Project::findVirtuals(const Symbol &symbol)
     if (symbol.kind != CXCursor_CXXMethod || !(symbol.flags & Symbol::VirtualMethod))
         return Set<Symbol>();
 
+    if (isComplete(OverrideIndex)) {
+        // every file is in the override index. symbol targets the methods it
+        // overrides and the overrides of a method include the indirect ones
+        // so the overrides of the root method are the whole family
+        Set<String> usrs = findTargetUsrs(symbol.location);
+        usrs.insert(symbol.usr);
+        Set<Symbol> ret;
+        ret.insert(symbol);
+        Set<Location> locations;
+        for (const String &usr : usrs) {
+            const auto it = mOverrides.edges.find(RTags::hashUsr(Sandbox::encoded(usr)));
+            if (it != mOverrides.edges.end())
+                locations.unite(it->second);
+            if (usr != symbol.usr) {
+                for (const Symbol &s : findByUsr(usr, symbol.location.fileId(), ArgDependsOn)) {
+                    if (s.kind == CXCursor_CXXMethod)
+                        ret.insert(s);
+                }
+            }
+        }
+        // the edges are keyed on hashed usrs so a method at one of the
+        // locations only belongs to the family if it overrides one of it.
+        // Indirect overrides can target a method that is only accepted later.
+        List<std::pair<Symbol, Set<String> > > candidates;
+        for (const Symbol &s : findSymbols(locations)) {
+            if (s.kind == CXCursor_CXXMethod && !ret.contains(s))
+                candidates.append(std::make_pair(s, findTargetUsrs(s.location)));
+        }
+        bool added = true;
+        while (added) {
+            added = false;
+            for (auto it = candidates.begin(); it != candidates.end(); ) {
+                bool overrides = false;
+                for (const String &usr : it->second) {
+                    if (usrs.contains(usr)) {
+                        overrides = true;
+                        break;
+                    }
+                }
+                if (overrides) {
+                    usrs.insert(it->first.usr);
+                    ret.insert(it->first);
+                    it = candidates.erase(it);
+                    added = true;
+                } else {
+                    ++it;
+                }
+            }
+        }
+        const Symbol target = findTarget(symbol);
+        if (!target.isNull())
+            ret.insert(target);
+        return ret;
+    }
+
     Symbol parent = [this](const Symbol &sym) {
         for (const String &usr : findTargetUsrs(sym.location)) {
             const Set<Symbol> syms = findByUsr(usr, sym.location.fileId(), ArgDependsOn);
@@ -1903,19 +2759,27 @@ Set<Symbol> Project::findVirtuals(const Symbol &symbol)
     return ret;
 }
 
-Set<String> Project::findTargetUsrs(Location loc)
+void Project::findTargetUsrs(uint32_t fileId, Location loc, Set<String> &usrs)
 {
-    Set<String> usrs;
-    auto targets = openTargets(loc.fileId());
-    if (targets) {
-        const int count = targets->count();
-        for (int i=0; i<count; ++i) {
-            if (targets->valueAt(i).contains(loc)) {
-                // SBROOT
-                usrs.insert(Sandbox::decoded(targets->keyAt(i)));
-            }
+    auto reverseTargets = openReverseTargets(fileId);
+    if (!reverseTargets)
+        return;
+    bool match;
+    const uint32_t idx = reverseTargets->lowerBound(loc, &match);
+    if (match) {
+        for (uint32_t target : reverseTargets->valueAt(idx)) {
+            const String usr = targetUsrAt(fileId, target);
+            // SBROOT
+            if (!usr.isEmpty())
+                usrs.insert(Sandbox::decoded(usr));
         }
     }
+}
+
+Set<String> Project::findTargetUsrs(Location loc)
+{
+    Set<String> usrs;
+    findTargetUsrs(loc.fileId(), loc, usrs);
     return usrs;
 }
 
@@ -1927,16 +2791,7 @@ Set<String> Project::findTargetUsrs(const Symbol &symbol)
 
     Set<String> usrs;
     for (uint32_t fileId : dependencies(symbol.location.fileId(), DependsOnArg)) {
-        auto targets = openTargets(fileId);
-        if (targets) {
-            const int count = targets->count();
-            for (int i=0; i<count; ++i) {
-                if (targets->valueAt(i).contains(symbol.location)) {
-                    // SBROOT
-                    usrs.insert(Sandbox::decoded(targets->keyAt(i)));
-                }
-            }
-        }
+        findTargetUsrs(fileId, symbol.location, usrs);
     }
     return usrs;
 }
@@ -1945,24 +2800,70 @@ Set<Symbol> Project::findSubclasses(const Symbol &symbol)
 {
     assert(symbol.isClass() && symbol.isDefinition());
     Set<Symbol> ret;
+    if (isComplete(SubclassIndex)) {
+        // every file is in the index
+        const auto it = mSubclasses.edges.find(RTags::hashUsr(Sandbox::encoded(symbol.usr)));
+        if (it == mSubclasses.edges.end())
+            return ret;
+        for (const Symbol &derived : findSymbols(it->second)) {
+            // the hash might collide
+            if (derived.isClass() && derived.baseClasses.contains(symbol.usr))
+                ret.insert(derived);
+        }
+        return ret;
+    }
+
     for (uint32_t dep : dependencies(symbol.location.fileId(), DependsOnArg)) {
         auto symbols = openSymbols(dep);
         if (symbols) {
             const int count = symbols->count();
             for (int i=0; i<count; ++i) {
-                const Symbol s = symbols->valueAt(i);
-                if (s.baseClasses.contains(symbol.usr))
-                    ret.insert(s);
+                // only the matches need their details
+                const Symbol candidate = symbols->valueAt(i, Symbol::Hot|Symbol::Names);
+                if (candidate.isClass() && candidate.baseClasses.contains(symbol.usr))
+                    ret.insert(symbols->valueAt(i));
             }
         }
     }
     return ret;
 }
 
+Set<Symbol> Project::findCalls(CallGraph::Direction direction, const Symbol &function)
+{
+    Set<Symbol> ret;
+    if (function.isNull() || !RTags::isFunction(function.kind) || function.usr.isEmpty())
+        return ret;
+
+    const String usr = Sandbox::encoded(function.usr);
+    Set<Location> locations;
+    if (isComplete(CallGraphIndex)) {
+        // every file is in the graph
+        locations = mCallGraph.find(direction, RTags::hashUsr(usr));
+    } else {
+        for (const auto &dep : mDependencies) {
+            auto fileMap = direction == CallGraph::Callers ? openCallers(dep.first) : openCallees(dep.first);
+            if (fileMap)
+                locations.unite(fileMap->value(usr));
+        }
+    }
+
+    Map<String, Symbol> functions;
+    for (const Symbol &sym : findSymbols(locations)) {
+        if (sym.isNull() || !RTags::isFunction(sym.kind))
+            continue;
+        Symbol &existing = functions[sym.usr];
+        if (existing.isNull() || (sym.isDefinition() && !existing.isDefinition()))
+            existing = sym;
+    }
+    for (const auto &it : functions)
+        ret.insert(it.second);
+    return ret;
+}
+
 void Project::beginScope()
 {
     assert(!mFileMapScope);
-    mFileMapScope.reset(new FileMapScope(shared_from_this(), Server::instance()->options().maxFileMapScopeCacheSize));
+    mFileMapScope.reset(new FileMapScope(shared_from_this()));
 }
 
 void Project::endScope()
@@ -2114,34 +3015,137 @@ void Project::dirty(uint32_t fileId)
     startDirtyJobs(&dirty, IndexerJob::Dirty);
 }
 
+std::shared_ptr<FileMapContainer> Project::openFileMaps(uint32_t fileId, String *err) const
+{
+    auto container = std::make_shared<FileMapContainer>();
+    if (mPackStore) {
+        const char *data;
+        uint32_t size;
+        std::shared_ptr<void> owner;
+        if (mPackStore->find(fileId, &data, &size, &owner))
+            return container->init(data, size, owner, err) ? container : std::shared_ptr<FileMapContainer>();
+    }
+    if (!container->load(fileMapsPath(fileId), err))
+        return std::shared_ptr<FileMapContainer>();
+    return container;
+}
+
+void Project::removeStaleFileMaps(uint32_t fileId)
+{
+    // readers that still have an older generation mapped keep it alive
+    // after it's unlinked
+    const String current = fileMapsName(mFileMapGenerations.value(fileId));
+    sourceFilePath(fileId).visit([&current](const Path &path) {
+            if (!strncmp(path.fileName(), "filemaps.", 9) && current != path.fileName())
+                path.rm();
+            return Path::Continue;
+        });
+}
+
+uint32_t Project::nextFileMapGeneration()
+{
+    return ++mFileMapGeneration;
+}
+
+String Project::fileMapsDigest(uint32_t fileId, uint32_t *generation) const
+{
+    *generation = mFileMapGenerations.value(fileId);
+    return *generation ? mFileMapDigests.value(fileId) : String();
+}
+
+bool Project::packFileMaps(uint32_t fileId)
+{
+    assert(mPackStore);
+    const Path path = fileMapsPath(fileId);
+    const String data = path.readAll();
+    if (data.isEmpty() || !mPackStore->insert(fileId, data)) {
+        // whatever is on disk is newer than the pack
+        mPackStore->remove(fileId);
+        return false;
+    }
+    path.rm();
+    return true;
+}
+
 bool Project::validate(uint32_t fileId, ValidateMode mode, String *err) const
 {
+    const Path path = fileMapsPath(fileId);
     if (mode == Validate) {
-        Path path;
         String error;
-        const uint32_t opts = fileMapOptions();
+        // maps that haven't been packed yet are newer than the pack
+        std::shared_ptr<FileMapContainer> container;
+        if (path.isFile()) {
+            container = std::make_shared<FileMapContainer>();
+            if (!container->load(path, &error))
+                goto error;
+        } else {
+            container = openFileMaps(fileId, &error);
+            if (!container)
+                goto error;
+        }
         {
-            path = sourceFilePath(fileId, fileMapName(SymbolNames));
             FileMap<String, Set<Location> > fileMap;
-            if (!fileMap.load(path, opts, &error))
+            if (!container->open(SymbolNames, fileMap, &error))
+                goto error;
+        }
+        {
+            SymbolNameSuffixes suffixes;
+            if (!container->open(SymbolSuffixes, suffixes, &error))
                 goto error;
         }
         {
-            path = sourceFilePath(fileId, fileMapName(Symbols));
             FileMap<Location, Symbol> fileMap;
-            if (!fileMap.load(path, opts, &error))
+            if (!container->open(Symbols, fileMap, &error))
+                goto error;
+        }
+        {
+            FileMap<uint64_t, Set<Location> > fileMap;
+            if (!container->open(Targets, fileMap, &error))
+                goto error;
+        }
+        {
+            FileMap<uint64_t, Set<Location> > fileMap;
+            if (!container->open(Usrs, fileMap, &error))
+                goto error;
+        }
+        {
+            FileMap<String, Set<Location> > fileMap;
+            if (!container->open(TargetCollisions, fileMap, &error))
+                goto error;
+        }
+        {
+            FileMap<String, Set<Location> > fileMap;
+            if (!container->open(UsrCollisions, fileMap, &error))
+                goto error;
+        }
+        {
+            FileMap<uint64_t, String> fileMap;
+            if (!container->open(UsrNames, fileMap, &error))
+                goto error;
+        }
+        {
+            FileMap<Location, Set<uint32_t> > fileMap;
+            if (!container->open(ReverseTargets, fileMap, &error))
                 goto error;
         }
         {
-            path = sourceFilePath(fileId, fileMapName(Targets));
             FileMap<String, Set<Location> > fileMap;
-            if (!fileMap.load(path, opts, &error))
+            if (!container->open(Subclasses, fileMap, &error))
                 goto error;
         }
         {
-            path = sourceFilePath(fileId, fileMapName(Usrs));
             FileMap<String, Set<Location> > fileMap;
-            if (!fileMap.load(path, opts, &error))
+            if (!container->open(Overrides, fileMap, &error))
+                goto error;
+        }
+        {
+            FileMap<String, Set<Location> > fileMap;
+            if (!container->open(Callers, fileMap, &error))
+                goto error;
+        }
+        {
+            FileMap<String, Set<Location> > fileMap;
+            if (!container->open(Callees, fileMap, &error))
                 goto error;
         }
         return true;
@@ -2151,12 +3155,11 @@ bool Project::validate(uint32_t fileId, ValidateMode mode, String *err) const
         return false;
     } else {
         assert(mode == StatOnly);
-        for (auto type : { Symbols, SymbolNames, Targets, Usrs }) {
-            const Path p = sourceFilePath(fileId, fileMapName(type));
-            if (!p.isFile()) {
-                Log(err) << "Error during validation:" << Location::path(fileId) << p << "doesn't exist";
-                return false;
-            }
+        if (mPackStore && mPackStore->contains(fileId))
+            return true;
+        if (!path.isFile()) {
+            Log(err) << "Error during validation:" << Location::path(fileId) << path << "doesn't exist";
+            return false;
         }
     }
     return true;
@@ -2249,17 +3252,12 @@ static List<String> formatField(const String &value, size_t max)
     return ret;
 }
 template <typename Key, typename Value>
-static String formatTable(const String &name, const std::shared_ptr<FileMap<Key, Value> > &fileMap, size_t width)
+static String formatTable(const String &name, const List<String> &keys, const List<String> &values,
+                          size_t maxKey, size_t maxValue, size_t width)
 {
+    assert(keys.size() == values.size());
     width -= 7; // padding
-    List<String> keys, values;
-    const int count = fileMap->count();
-    size_t maxKey = 0;
-    size_t maxValue = 0;
-    for (int i=0; i<count; ++i) {
-        keys << toString(fileMap->keyAt(i), maxKey);
-        values << toString(fileMap->valueAt(i), maxValue);
-    }
+    const int count = keys.size();
     if (maxKey + maxValue > width) {
         if (maxKey < maxValue) {
             maxKey = std::min(maxKey, static_cast<size_t>(width * .4));
@@ -2289,6 +3287,36 @@ static String formatTable(const String &name, const std::shared_ptr<FileMap<Key,
     return ret;
 }
 
+template <typename Key, typename Value>
+static String formatTable(const String &name, const std::shared_ptr<FileMap<Key, Value> > &fileMap, size_t width)
+{
+    List<String> keys, values;
+    const int count = fileMap->count();
+    size_t maxKey = 0;
+    size_t maxValue = 0;
+    for (int i=0; i<count; ++i) {
+        keys << toString(fileMap->keyAt(i), maxKey);
+        values << toString(fileMap->valueAt(i), maxValue);
+    }
+    return formatTable<Key, Value>(name, keys, values, maxKey, maxValue, width);
+}
+
+// the suffixes and the names they're taken from
+static String formatTable(const String &name, const std::shared_ptr<SymbolNameSuffixes> &suffixes,
+                          const std::shared_ptr<FileMap<String, Set<Location> > > &symbolNames, size_t width)
+{
+    List<String> keys, values;
+    const int count = suffixes->count();
+    size_t maxKey = 0;
+    size_t maxValue = 0;
+    String buffer;
+    for (int i=0; i<count; ++i) {
+        keys << toString(suffixes->view(*symbolNames, i, buffer).toString(), maxKey);
+        values << toString(symbolNames->keyAt(suffixes->at(i).name), maxValue);
+    }
+    return formatTable<String, String>(name, keys, values, maxKey, maxValue, width);
+}
+
 void Project::dumpFileMaps(const std::shared_ptr<QueryMessage> &msg, const std::shared_ptr<Connection> &conn)
 {
     beginScope();
@@ -2318,6 +3346,16 @@ void Project::dumpFileMaps(const std::shared_ptr<QueryMessage> &msg, const std::
         }
     }
 
+    if (args.empty() || args.contains("symsuffixes")) {
+        auto names = openSymbolNames(fileId, &err);
+        auto suffixes = names ? openSymbolNameSuffixes(fileId, &err) : std::shared_ptr<SymbolNameSuffixes>();
+        if (suffixes) {
+            conn->write(formatTable("Symbol name suffixes:", suffixes, names, msg->terminalWidth()));
+        } else {
+            conn->write(err);
+        }
+    }
+
     if (args.empty() || args.contains("targets")) {
         if (auto tbl = openTargets(fileId, &err)) {
             conn->write(formatTable("Targets:", tbl, msg->terminalWidth()));
@@ -2334,6 +3372,62 @@ void Project::dumpFileMaps(const std::shared_ptr<QueryMessage> &msg, const std::
         }
     }
 
+    if (args.empty() || args.contains("targetcollisions")) {
+        if (auto tbl = openTargetCollisions(fileId, &err)) {
+            conn->write(formatTable("Target collisions:", tbl, msg->terminalWidth()));
+        } else {
+            conn->write(err);
+        }
+    }
+
+    if (args.empty() || args.contains("usrcollisions")) {
+        if (auto tbl = openUsrCollisions(fileId, &err)) {
+            conn->write(formatTable("Usr collisions:", tbl, msg->terminalWidth()));
+        } else {
+            conn->write(err);
+        }
+    }
+
+    if (args.empty() || args.contains("usrnames")) {
+        if (auto tbl = openUsrNames(fileId, &err)) {
+            conn->write(formatTable("Usr names:", tbl, msg->terminalWidth()));
+        } else {
+            conn->write(err);
+        }
+    }
+
+    if (args.empty() || args.contains("subclasses")) {
+        if (auto tbl = openSubclasses(fileId, &err)) {
+            conn->write(formatTable("Subclasses:", tbl, msg->terminalWidth()));
+        } else {
+            conn->write(err);
+        }
+    }
+
+    if (args.empty() || args.contains("overrides")) {
+        if (auto tbl = openOverrides(fileId, &err)) {
+            conn->write(formatTable("Overrides:", tbl, msg->terminalWidth()));
+        } else {
+            conn->write(err);
+        }
+    }
+
+    if (args.empty() || args.contains("callers")) {
+        if (auto tbl = openCallers(fileId, &err)) {
+            conn->write(formatTable("Callers:", tbl, msg->terminalWidth()));
+        } else {
+            conn->write(err);
+        }
+    }
+
+    if (args.empty() || args.contains("callees")) {
+        if (auto tbl = openCallees(fileId, &err)) {
+            conn->write(formatTable("Callees:", tbl, msg->terminalWidth()));
+        } else {
+            conn->write(err);
+        }
+    }
+
     if (args.empty() || args.contains("tokens")) {
         if (auto tbl = openTokens(fileId, &err)) {
             conn->write(formatTable("Tokens:", tbl, msg->terminalWidth()));
@@ -2342,6 +3436,14 @@ void Project::dumpFileMaps(const std::shared_ptr<QueryMessage> &msg, const std::
         }
     }
 
+    if (args.empty() || args.contains("rtargets")) {
+        if (auto tbl = openReverseTargets(fileId, &err)) {
+            conn->write(formatTable("Reverse targets:", tbl, msg->terminalWidth()));
+        } else {
+            conn->write(err);
+        }
+    }
+
 
     endScope();
 }
@@ -2473,6 +3575,14 @@ size_t estimateMemory(const Hash<Key, Value> &container)
     return estimateKeyValueContainer(container);
 }
 
+size_t Project::UsrEdges::memory() const
+{
+    size_t ret = ::estimateMemory(edges);
+    for (const auto &file : files)
+        ret += file.second.size() * sizeof(std::pair<uint64_t, Location>);
+    return ret;
+}
+
 String Project::estimateMemory() const
 {
     List<String> ret;
@@ -2494,6 +3604,20 @@ String Project::estimateMemory() const
         deps += ::estimateMemory(*dep.second);
     }
     add("Dependencies", deps);
+    size_t filters = 0;
+    for (const auto &filter : mUsrFilters)
+        filters += filter.second.memory();
+    for (const auto &filter : mTargetFilters)
+        filters += filter.second.memory();
+    add("Usr filters", filters);
+    size_t usrIndex = ::estimateMemory(mUsrIndex);
+    for (const auto &file : mFileUsrs)
+        usrIndex += file.second.size() * sizeof(uint64_t);
+    add("Usr index", usrIndex);
+    add("Symbol name index", mSymbolNameIndex->memory());
+    add("Subclass index", mSubclasses.memory());
+    add("Override index", mOverrides.memory());
+    add("Call graph", mCallGraph.memory());
     add("Total", total);
     return String::join(ret, "\n");
 }
@@ -2532,14 +3656,6 @@ void Project::reloadCompileCommands()
     }
 }
 
-uint32_t Project::fileMapOptions() const
-{
-    uint32_t options = FileMap<int, int>::None;
-    if (Server::instance()->options().options & Server::NoFileLock)
-        options |= FileMap<int, int>::NoLock;
-    return options;
-}
-
 void Project::fixPCH(Source &source)
 {
     for (Source::Include &inc : source.includePaths) {
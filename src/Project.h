@@ -19,8 +19,11 @@
 #include <cstdint>
 #include <mutex>
 
+#include "BloomFilter.h"
+#include "CallGraph.h"
 #include "Diagnostic.h"
 #include "FileMap.h"
+#include "FileMapContainer.h"
 #include "IndexerJob.h"
 #include "IndexMessage.h"
 #include "QueryMessage.h"
@@ -33,6 +36,8 @@
 #include "rct/Timer.h"
 #include "rct/Serializer.h"
 #include "RTags.h"
+#include "SymbolNameIndex.h"
+#include "SymbolNameSuffixes.h"
 #include "Token.h"
 
 class Connection;
@@ -40,6 +45,7 @@ class Dirty;
 class FileManager;
 class IndexDataMessage;
 class Match;
+class PackStore;
 class RestoreThread;
 struct DependencyNode
 {
@@ -66,7 +72,7 @@ struct DependencyNode
 
 RCT_FLAGS(DependencyNode::Flag);
 
-class Project : public std::enable_shared_from_this<Project>
+class Project : public std::enable_shared_from_this<Project>, public FileMapTypes
 {
 public:
     Project(const Path &path);
@@ -79,51 +85,83 @@ public:
     Path projectDataDir() const { return mProjectDataDir; }
     bool match(const Match &match, bool *indexed = 0) const;
 
-    enum FileMapType {
-        Symbols,
-        SymbolNames,
-        Targets,
-        Usrs,
-        Tokens
-    };
-    static const char *fileMapName(FileMapType type)
+    Path fileMapsPath(uint32_t fileId) const { return sourceFilePath(fileId, fileMapsName(mFileMapGenerations.value(fileId)).constData()); }
+    uint32_t nextFileMapGeneration();
+    // digest of the current file maps of fileId, empty if there are none
+    String fileMapsDigest(uint32_t fileId, uint32_t *generation) const;
+    // the time of the parse that produced the file maps of fileId, 0 if
+    // there are none
+    uint64_t fileMapsParseTime(uint32_t fileId) const { return mFileMapParseTimes.value(fileId); }
+    std::shared_ptr<FileMap<String, Set<Location> > > openSymbolNames(uint32_t fileId, String *err = 0)
     {
-        switch (type) {
-        case Symbols: return "symbols";
-        case SymbolNames: return "symnames";
-        case Targets: return "targets";
-        case Usrs: return "usrs";
-        case Tokens: return "tokens";
-        }
-        return 0;
+        return openFileMap(SymbolNames, fileId, &FileMapCache::Entry::symbolNames, err);
     }
-    std::shared_ptr<FileMap<String, Set<Location> > > openSymbolNames(uint32_t fileId, String *err = 0)
+    // the less qualified permutations of the keys in openSymbolNames()
+    std::shared_ptr<SymbolNameSuffixes> openSymbolNameSuffixes(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<String, Set<Location> >(SymbolNames, fileId, mFileMapScope->symbolNames, err);
+        return openFileMap(SymbolSuffixes, fileId, &FileMapCache::Entry::symbolNameSuffixes, err);
     }
     std::shared_ptr<FileMap<Location, Symbol> > openSymbols(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<Location, Symbol>(Symbols, fileId, mFileMapScope->symbols, err);
+        return openFileMap(Symbols, fileId, &FileMapCache::Entry::symbols, err);
     }
-    std::shared_ptr<FileMap<String, Set<Location> > > openTargets(uint32_t fileId, String *err = 0)
+    // targets and usrs are keyed on RTags::hashUsr(), usrs whose hashes
+    // collide within a file are in the collision maps instead
+    std::shared_ptr<FileMap<uint64_t, Set<Location> > > openTargets(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<String, Set<Location> >(Targets, fileId, mFileMapScope->targets, err);
+        return openFileMap(Targets, fileId, &FileMapCache::Entry::targets, err);
     }
-    std::shared_ptr<FileMap<String, Set<Location> > > openUsrs(uint32_t fileId, String *err = 0)
+    std::shared_ptr<FileMap<uint64_t, Set<Location> > > openUsrs(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<String, Set<Location> >(Usrs, fileId, mFileMapScope->usrs, err);
+        return openFileMap(Usrs, fileId, &FileMapCache::Entry::usrs, err);
     }
+    std::shared_ptr<FileMap<String, Set<Location> > > openTargetCollisions(uint32_t fileId, String *err = 0)
+    {
+        return openFileMap(TargetCollisions, fileId, &FileMapCache::Entry::targetCollisions, err);
+    }
+    std::shared_ptr<FileMap<String, Set<Location> > > openUsrCollisions(uint32_t fileId, String *err = 0)
+    {
+        return openFileMap(UsrCollisions, fileId, &FileMapCache::Entry::usrCollisions, err);
+    }
+    // the usr strings of the hashed keys in targets and usrs
+    std::shared_ptr<FileMap<uint64_t, String> > openUsrNames(uint32_t fileId, String *err = 0)
+    {
+        return openFileMap(UsrNames, fileId, &FileMapCache::Entry::usrNames, err);
+    }
+    // base class usr -> definitions of the classes in this file that derive from it
+    std::shared_ptr<FileMap<String, Set<Location> > > openSubclasses(uint32_t fileId, String *err = 0)
+    {
+        return openFileMap(Subclasses, fileId, &FileMapCache::Entry::subclasses, err);
+    }
+    // virtual method usr -> declarations and definitions of the methods in this file that override it
+    std::shared_ptr<FileMap<String, Set<Location> > > openOverrides(uint32_t fileId, String *err = 0)
+    {
+        return openFileMap(Overrides, fileId, &FileMapCache::Entry::overrides, err);
+    }
+    // function usr -> definitions of the functions in this file that call it
+    std::shared_ptr<FileMap<String, Set<Location> > > openCallers(uint32_t fileId, String *err = 0)
+    {
+        return openFileMap(Callers, fileId, &FileMapCache::Entry::callers, err);
+    }
+    // function usr -> declarations of the functions its definition in this file calls
+    std::shared_ptr<FileMap<String, Set<Location> > > openCallees(uint32_t fileId, String *err = 0)
+    {
+        return openFileMap(Callees, fileId, &FileMapCache::Entry::callees, err);
+    }
+    // type is Usrs or Targets, usr is sandbox encoded
+    Set<Location> usrLocations(FileMapType type, uint32_t fileId, const String &usr, uint64_t hash);
+    // index is an index into the targets map followed by the target collisions
+    String targetUsrAt(uint32_t fileId, uint32_t index);
 
     std::shared_ptr<FileMap<uint32_t, Token> > openTokens(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<uint32_t, Token>(Tokens, fileId, mFileMapScope->tokens, err);
+        return openFileMap(Tokens, fileId, &FileMapCache::Entry::tokens, err);
+    }
+    // location to indexes of the target usrs, see targetUsrAt()
+    std::shared_ptr<FileMap<Location, Set<uint32_t> > > openReverseTargets(uint32_t fileId, String *err = 0)
+    {
+        return openFileMap(ReverseTargets, fileId, &FileMapCache::Entry::reverseTargets, err);
     }
-
 
     enum DependencyMode {
         DependsOnArg,
@@ -144,19 +182,28 @@ public:
         Exact,
         Wildcard,
         Regexp,
-        StartsWith
+        StartsWith,
+        Fuzzy
     };
+    // with QueryMessage::MatchFuzzy func is called for the best max matches,
+    // best first
     void findSymbols(const String &symbolName,
                      const std::function<void(SymbolMatchType, const String &, const Set<Location> &)> &func,
                      Flags<QueryMessage::Flag> queryFlags,
-                     uint32_t fileFilter = 0);
+                     uint32_t fileFilter = 0,
+                     int max = -1);
 
     static bool matchSymbolName(const String &pattern, const String &symbolName, String::CaseSensitivity cs)
     {
         return Rct::wildCmp(pattern.constData(), symbolName.constData(), cs);
     }
 
-    Symbol findSymbol(Location location, int *index = 0);
+    // columns is a mask of Symbol::Column, Symbol::Hot is always read
+    Symbol findSymbol(Location location, int *index = 0, uint32_t columns = Symbol::AllColumns);
+    // findSymbol() for each location, the ones in the same file are resolved
+    // in one pass with FileMap::lowerBounds()
+    List<Symbol> findSymbols(const Set<Location> &locations, List<int> *indexes = 0,
+                             uint32_t columns = Symbol::AllColumns);
     Set<Symbol> findTargets(Location location) { return findTargets(findSymbol(location)); }
     Set<Symbol> findTargets(const Symbol &symbol);
     Symbol findTarget(Location location) { return RTags::bestTarget(findTargets(location)); }
@@ -170,8 +217,16 @@ public:
     Set<String> findTargetUsrs(const Symbol &symbol);
     Set<String> findTargetUsrs(Location loc);
     Set<Symbol> findSubclasses(const Symbol &symbol);
+    /*
+     * The functions whose definitions call function for CallGraph::Callers,
+     * the functions the definitions of function call for CallGraph::Callees.
+     * One symbol per usr, the definition if there is one.
+     */
+    Set<Symbol> findCalls(CallGraph::Direction direction, const Symbol &function);
 
     Set<Symbol> findByUsr(const String &usr, uint32_t fileId, DependencyMode mode);
+    // false if fileId's usrs/targets map definitely doesn't have this (sandbox encoded) usr
+    bool mightContainUsr(FileMapType type, uint32_t fileId, uint64_t usrHash) const;
 
     Path sourceFilePath(uint32_t fileId, const char *path = "") const;
 
@@ -245,7 +300,8 @@ public:
     String diagnosticsToString(Flags<QueryMessage::Flag> flags, uint32_t fileId);
     void diagnose(uint32_t fileId);
     void diagnoseAll();
-    uint32_t fileMapOptions() const;
+    // from the pack store if enabled, otherwise from fileMapsPath(fileId)
+    std::shared_ptr<FileMapContainer> openFileMaps(uint32_t fileId, String *error = 0) const;
     void fixPCH(Source &source);
     void includeCompletions(Flags<QueryMessage::Flag> flags, const std::shared_ptr<Connection> &conn, Source &&source) const;
     size_t bytesWritten() const { return mBytesWritten; }
@@ -286,6 +342,43 @@ private:
     bool validate(uint32_t fileId, ValidateMode mode, String *error = 0) const;
     void removeDependencies(uint32_t fileId);
     void updateDependencies(uint32_t fileId, const std::shared_ptr<IndexDataMessage> &msg);
+    void updateUsrIndex(uint32_t fileId);
+    void removeUsrIndex(uint32_t fileId);
+    void updateUsrEdges(uint32_t fileId);
+    void removeUsrEdges(uint32_t fileId);
+    void updateCallGraph(uint32_t fileId);
+    void updateSymbolNameIndex(const Set<uint32_t> &files);
+
+    // the project wide indexes built from the file maps
+    enum ProjectIndex {
+        UsrIndex,
+        NameIndex,
+        SubclassIndex,
+        OverrideIndex,
+        CallGraphIndex,
+        ProjectIndexCount
+    };
+    bool indexContains(ProjectIndex index, uint32_t fileId) const;
+    /*
+     * True if index has every dependency that has file maps, only then can
+     * queries use it instead of opening the file maps of every file. The
+     * answer is cached until invalidateIndexes() is called, which has to
+     * happen whenever the dependencies, the file map generations or one of
+     * the indexes change.
+     */
+    bool isComplete(ProjectIndex index) const;
+    void invalidateIndexes() { ++mIndexGeneration; }
+    // adds the files the indexes are missing a batch at a time
+    void scheduleIndexRebuild();
+    void onIndexRebuildTimeout(Timer *);
+    // locations of name in the symnames map of fileId or one of its suffixes
+    Set<Location> symbolNameLocations(uint32_t fileId, const String &name);
+    void findFuzzySymbols(const String &query,
+                          const std::function<void(SymbolMatchType, const String &, const Set<Location> &)> &func,
+                          uint32_t fileFilter, int max);
+    void findTargetUsrs(uint32_t fileId, Location loc, Set<String> &usrs);
+    bool packFileMaps(uint32_t fileId);
+    void removeStaleFileMaps(uint32_t fileId);
     void loadFailed(uint32_t fileId);
     void updateFixIts(const Set<uint32_t> &visited, FixIts &fixIts);
     int startDirtyJobs(Dirty *dirty,
@@ -295,120 +388,98 @@ private:
     void onDirtyTimeout(Timer *);
     bool isTemplateDiagnostic(const std::pair<Location, Diagnostic> &diagnostic);
 
-    struct FileMapScope {
-        FileMapScope(const std::shared_ptr<Project> &proj, int m)
-            : project(proj), openedFiles(0), totalOpened(0), max(m), loadFailed(false)
+    /*
+     * Mapped file maps are kept around across queries until they're evicted
+     * to stay within Server::Options::fileMapCacheSize bytes or new data for
+     * the file comes in.
+     */
+    struct FileMapCache {
+        FileMapCache()
+            : size(0), maxSize(0), hits(0), misses(0)
         {}
-        ~FileMapScope()
-        {
-            warning() << "Query opened" << totalOpened << "files for project" << project->path();
-            if (loadFailed)
-                project->validateAll();
-        }
 
-        struct LRUKey {
-            FileMapType type;
-            uint32_t fileId;
-            bool operator<(const LRUKey &other) const
-            {
-                return fileId < other.fileId || (fileId == other.fileId && type < other.type);
-            }
-        };
-        struct LRUEntry {
-            LRUEntry(FileMapType t, uint32_t f)
-                : key({ t, f })
+        struct Entry {
+            Entry(uint32_t f, const std::shared_ptr<FileMapContainer> &c)
+                : fileId(f), container(c)
             {}
-            const LRUKey key;
-
-            std::shared_ptr<LRUEntry> next, prev;
+            const uint32_t fileId;
+            const std::shared_ptr<FileMapContainer> container;
+            std::shared_ptr<FileMap<String, Set<Location> > > symbolNames, targetCollisions, usrCollisions, subclasses, overrides, callers, callees;
+            std::shared_ptr<FileMap<uint64_t, Set<Location> > > targets, usrs;
+            std::shared_ptr<FileMap<uint64_t, String> > usrNames;
+            std::shared_ptr<SymbolNameSuffixes> symbolNameSuffixes;
+            std::shared_ptr<FileMap<Location, Symbol> > symbols;
+            std::shared_ptr<FileMap<uint32_t, Token> > tokens;
+            std::shared_ptr<FileMap<Location, Set<uint32_t> > > reverseTargets;
+
+            std::shared_ptr<Entry> next, prev;
         };
 
-        void poke(FileMapType t, uint32_t f)
+        std::shared_ptr<Entry> find(uint32_t fileId)
         {
-            const LRUKey key = { t, f };
-            auto ptr = entryMap.value(key);
-            assert(ptr);
-            entryList.remove(ptr);
-            entryList.append(ptr);
+            auto it = entries.find(fileId);
+            if (it == entries.end())
+                return std::shared_ptr<Entry>();
+            ++hits;
+            list.remove(it->second);
+            list.append(it->second);
+            return it->second;
         }
 
-        template <typename Key, typename Value>
-        std::shared_ptr<FileMap<Key, Value> > openFileMap(FileMapType type, uint32_t fileId,
-                                                          Hash<uint32_t, std::shared_ptr<FileMap<Key, Value> > > &cache,
-                                                          String *errPtr)
+        void insert(const std::shared_ptr<Entry> &entry)
         {
-            auto it = cache.find(fileId);
-            if (it != cache.end()) {
-                poke(type, fileId);
-                return it->second;
-            }
-            const Path path = project->sourceFilePath(fileId, Project::fileMapName(type));
-            auto fileMap = std::make_shared<FileMap<Key, Value>>();
-            String err;
-            if (fileMap->load(path, project->fileMapOptions(), &err)) {
-                ++totalOpened;
-                cache[fileId] = fileMap;
-                auto entry = std::make_shared<LRUEntry>(type, fileId);
-                entryList.append(entry);
-                entryMap[entry->key] = entry;
-                if (++openedFiles > max) {
-                    const std::shared_ptr<LRUEntry> e = entryList.takeFirst();
-                    assert(e);
-                    entryMap.remove(e->key);
-                    switch (e->key.type) {
-                    case SymbolNames:
-                        assert(symbolNames.contains(e->key.fileId));
-                        symbolNames.remove(e->key.fileId);
-                        break;
-                    case Symbols:
-                        assert(symbols.contains(e->key.fileId));
-                        symbols.remove(e->key.fileId);
-                        break;
-                    case Targets:
-                        assert(targets.contains(e->key.fileId));
-                        targets.remove(e->key.fileId);
-                        break;
-                    case Usrs:
-                        assert(usrs.contains(e->key.fileId));
-                        usrs.remove(e->key.fileId);
-                        break;
-                    case Tokens:
-                        assert(tokens.contains(e->key.fileId));
-                        tokens.remove(e->key.fileId);
-                        break;
-                    }
-                    --openedFiles;
-                }
-                assert(openedFiles <= max);
-            } else {
-                if (errPtr) {
-                    *errPtr = "Failed to open: " + path + " " + Location::path(fileId) + ": " + err;
-                } else {
-                    error() << "Failed to open" << path << Location::path(fileId) << err;
-                }
-                loadFailed = true;
-                fileMap.reset();
+            assert(!entries.contains(entry->fileId));
+            ++misses;
+            entries[entry->fileId] = entry;
+            list.append(entry);
+            size += entry->container->size();
+            // maps still in use keep their container alive after eviction
+            while (size > maxSize && list.first() != entry)
+                remove(list.first()->fileId);
+        }
+
+        void remove(uint32_t fileId)
+        {
+            const std::shared_ptr<Entry> entry = entries.take(fileId);
+            if (entry) {
+                list.remove(entry);
+                size -= entry->container->size();
             }
-            return fileMap;
         }
 
-        Hash<uint32_t, std::shared_ptr<FileMap<String, Set<Location> > > > symbolNames;
-        Hash<uint32_t, std::shared_ptr<FileMap<Location, Symbol> > > symbols;
-        Hash<uint32_t, std::shared_ptr<FileMap<String, Set<Location> > > > targets, usrs;
-        Hash<uint32_t, std::shared_ptr<FileMap<uint32_t, Token> > > tokens;
+        Hash<uint32_t, std::shared_ptr<Entry> > entries;
+        EmbeddedLinkedList<std::shared_ptr<Entry> > list;
+        size_t size, maxSize, hits, misses;
+    };
+
+    template <typename T>
+    std::shared_ptr<T> openFileMap(FileMapType type, uint32_t fileId,
+                                   std::shared_ptr<T> FileMapCache::Entry::*member,
+                                   String *errPtr);
+
+    struct FileMapScope {
+        FileMapScope(const std::shared_ptr<Project> &proj)
+            : project(proj), hits(proj->mFileMapCache.hits), misses(proj->mFileMapCache.misses), loadFailed(false)
+        {}
+        ~FileMapScope()
+        {
+            warning() << "Query opened" << (project->mFileMapCache.misses - misses) << "files,"
+                      << (project->mFileMapCache.hits - hits) << "cached for project" << project->path();
+            if (loadFailed)
+                project->validateAll();
+        }
+
         std::shared_ptr<Project> project;
-        int openedFiles, totalOpened;
-        const int max;
+        const size_t hits, misses;
         bool loadFailed;
-
-        EmbeddedLinkedList<std::shared_ptr<LRUEntry> > entryList;
-        Map<LRUKey, std::shared_ptr<LRUEntry> > entryMap;
     };
 
+    FileMapCache mFileMapCache;
     std::shared_ptr<FileMapScope> mFileMapScope;
+    std::shared_ptr<PackStore> mPackStore;
 
     const Path mPath, mProjectDataDir;
-    Path mProjectFilePath, mSourcesFilePath;
+    Path mProjectFilePath, mSourcesFilePath, mUsrIndexFilePath, mSymbolNameIndexFilePath, mUsrEdgesFilePath, mCallGraphFilePath;
 
     Files mFiles;
 
@@ -432,8 +503,52 @@ private:
     Hash<uint32_t, DependencyNode*> mDependencies;
     Set<uint32_t> mSuspendedFiles;
 
+    // keyed on fileId, files without a filter might contain anything
+    Hash<uint32_t, BloomFilter> mUsrFilters, mTargetFilters;
+    // hashes of the keys in each file's usrs map and the reverse, usr hash to fileIds
+    Hash<uint32_t, List<uint64_t> > mFileUsrs;
+    Hash<uint64_t, Set<uint32_t> > mUsrIndex;
+    std::shared_ptr<SymbolNameIndex> mSymbolNameIndex;
+    /*
+     * The edges of the subclasses or overrides maps of all files keyed on
+     * the hash of the usr, e.g. base class -> derived classes. The edges of
+     * each file are kept as well so they can be replaced when it's indexed
+     * again, only those are saved.
+     */
+    struct UsrEdges {
+        Hash<uint32_t, List<std::pair<uint64_t, Location> > > files;
+        Hash<uint64_t, Set<Location> > edges;
+
+        void insert(uint32_t fileId, const FileMap<String, Set<Location> > &fileMap);
+        void remove(uint32_t fileId);
+        // fills in edges after files was restored
+        void restore();
+        size_t memory() const;
+    };
+    UsrEdges mSubclasses, mOverrides;
+    CallGraph mCallGraph;
+    struct IndexCoverage {
+        IndexCoverage()
+            : generation(0), complete(false)
+        {}
+
+        uint32_t generation;
+        bool complete;
+    };
+    uint32_t mIndexGeneration;
+    mutable IndexCoverage mIndexCoverage[ProjectIndexCount];
+    Timer mIndexRebuildTimer;
+    Set<uint32_t> mIndexRebuildFiles;
+
     size_t mBytesWritten;
     bool mSaveDirty;
+    // fileId -> generation of its file maps container
+    Hash<uint32_t, uint32_t> mFileMapGenerations;
+    // digests of the current generations, rp compares against them
+    Hash<uint32_t, String> mFileMapDigests;
+    // when the file maps of a file were last confirmed by a parse
+    Hash<uint32_t, uint64_t> mFileMapParseTimes;
+    uint32_t mFileMapGeneration;
 
     mutable std::mutex mMutex;
 };
@@ -474,4 +589,49 @@ inline Path Project::sourceFilePath(uint32_t fileId, const char *type) const
     return String::format<1024>("%s%d/%s", mProjectDataDir.constData(), fileId, type);
 }
 
+template <typename T>
+inline std::shared_ptr<T> Project::openFileMap(FileMapType type, uint32_t fileId,
+                                               std::shared_ptr<T> FileMapCache::Entry::*member,
+                                               String *errPtr)
+{
+    std::shared_ptr<FileMapCache::Entry> entry = mFileMapCache.find(fileId);
+    if (!entry) {
+        String err;
+        auto container = openFileMaps(fileId, &err);
+        if (!container) {
+            const Path path = fileMapsPath(fileId);
+            if (errPtr) {
+                *errPtr = "Failed to open: " + path + " " + Location::path(fileId) + ": " + err;
+            } else {
+                error() << "Failed to open" << path << Location::path(fileId) << err;
+            }
+            if (mFileMapScope)
+                mFileMapScope->loadFailed = true;
+            return std::shared_ptr<T>();
+        }
+        entry = std::make_shared<FileMapCache::Entry>(fileId, container);
+        mFileMapCache.insert(entry);
+    }
+
+    std::shared_ptr<T> &fileMap = (*entry).*member;
+    if (!fileMap) {
+        auto map = std::make_shared<T>();
+        String err;
+        if (!entry->container->open(type, *map, &err)) {
+            const Path path = fileMapsPath(fileId);
+            if (errPtr) {
+                *errPtr = String::format<128>("Failed to open %s in: ", fileMapName(type))
+                          + path + " " + Location::path(fileId) + ": " + err;
+            } else {
+                error() << "Failed to open" << fileMapName(type) << "in" << path << Location::path(fileId) << err;
+            }
+            if (mFileMapScope)
+                mFileMapScope->loadFailed = true;
+            return std::shared_ptr<T>();
+        }
+        fileMap = map;
+    }
+    return fileMap;
+}
+
 #endif
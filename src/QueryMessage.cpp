@@ -19,7 +19,7 @@
 #include "RTags.h"
 
 QueryMessage::QueryMessage(Type type)
-    : RTagsMessage(MessageId), mType(type), mMax(-1), mMinLine(-1), mMaxLine(-1), mBuildIndex(0), mTerminalWidth(-1)
+    : RTagsMessage(MessageId), mType(type), mMax(-1), mMinLine(-1), mMaxLine(-1), mBuildIndex(0), mDepth(1), mTerminalWidth(-1)
 {
 }
 
@@ -27,7 +27,7 @@ void QueryMessage::encode(Serializer &serializer) const
 {
     serializer << mCommandLine << mQuery << mCodeCompletePrefix << mType << mFlags << mMax
                << mMinLine << mMaxLine << mBuildIndex << mPathFilters << mKindFilters
-               << mCurrentFile << mUnsavedFiles << mTerminalWidth
+               << mCurrentFile << mUnsavedFiles << mTerminalWidth << mDepth
 #ifdef RTAGS_HAS_LUA
                << mVisitASTScripts
 #endif
@@ -38,7 +38,7 @@ void QueryMessage::decode(Deserializer &deserializer)
 {
     deserializer >> mCommandLine >> mQuery >> mCodeCompletePrefix >> mType >> mFlags >> mMax
                  >> mMinLine >> mMaxLine >> mBuildIndex >> mPathFilters >> mKindFilters
-                 >> mCurrentFile >> mUnsavedFiles >> mTerminalWidth
+                 >> mCurrentFile >> mUnsavedFiles >> mTerminalWidth >> mDepth
 #ifdef RTAGS_HAS_LUA
                  >> mVisitASTScripts
 #endif
@@ -84,6 +84,10 @@ QueryMessage::Flag QueryMessage::flagFromString(const String &string)
         return MatchRegex;
     } else if (string == "match-case-insensitive") {
         return MatchCaseInsensitive;
+    } else if (string == "match-fuzzy") {
+        return MatchFuzzy;
+    } else if (string == "call-hierarchy-callees") {
+        return CallHierarchyCallees;
     } else if (string == "find-virtuals") {
         return FindVirtuals;
     } else if (string == "silent") {
@@ -72,7 +72,8 @@ public:
 #ifdef RTAGS_HAS_LUA
         VisitAST,
 #endif
-        Tokens
+        Tokens,
+        CallHierarchy
     };
 
     enum Flag {
@@ -123,7 +124,9 @@ public:
         CodeCompletionEnabled = (1ull << 43),
         SynchronousDiagnostics = (1ull << 44),
         CodeCompleteNoWait = (1ull << 45),
-        AllTargets = (1ull << 46)
+        AllTargets = (1ull << 46),
+        MatchFuzzy = (1ull << 47),
+        CallHierarchyCallees = (1ull << 48)
     };
 
     QueryMessage(Type type = Invalid);
@@ -211,6 +214,10 @@ public:
     int max() const { return mMax; }
     void setMax(int max) { mMax = max; }
 
+    // levels of CallHierarchy to list, 0 for all of them
+    int depth() const { return mDepth; }
+    void setDepth(int depth) { mDepth = depth; }
+
     Flags<Flag> flags() const { return mFlags; }
     void setFlags(Flags<Flag> flags)
     {
@@ -246,7 +253,7 @@ private:
     String mQuery, mCodeCompletePrefix;
     Type mType;
     Flags<QueryMessage::Flag> mFlags;
-    int mMax, mMinLine, mMaxLine, mBuildIndex;
+    int mMax, mMinLine, mMaxLine, mBuildIndex, mDepth;
     List<PathFilter> mPathFilters;
     KindFilters mKindFilters;
     Path mCurrentFile;
@@ -108,6 +108,7 @@ std::initializer_list<CommandLineParser::Option<RClient::OptionType> > opts = {
     { RClient::RemoveBuffers, "remove-buffers", 0, CommandLineParser::Required, "Remove buffers." },
     { RClient::ListCursorKinds, "list-cursor-kinds", 0, CommandLineParser::NoValue, "List spelling for known cursor kinds." },
     { RClient::ClassHierarchy, "class-hierarchy", 0, CommandLineParser::Required, "Dump class hierarcy for struct/class at location." },
+    { RClient::CallHierarchy, "call-hierarchy", 0, CommandLineParser::Required, "Dump the functions calling the function at location and their callers." },
     { RClient::DebugLocations, "debug-locations", 0, CommandLineParser::Optional, "Manipulate debug locations." },
 #ifdef RTAGS_HAS_LUA
     { RClient::VisitAST, "visit-ast", 0, CommandLineParser::Required, "Visit AST of a source file." },
@@ -118,6 +119,8 @@ std::initializer_list<CommandLineParser::Option<RClient::OptionType> > opts = {
     { RClient::None, String(), 0, CommandLineParser::NoValue, "Command flags:" },
     { RClient::StripParen, "strip-paren", 'p', CommandLineParser::NoValue, "Strip parens in various contexts." },
     { RClient::Max, "max", 'M', CommandLineParser::Required, "Max lines of output for queries." },
+    { RClient::Callees, "callees", 0, CommandLineParser::NoValue, "Use with --call-hierarchy to dump the functions called by the function instead." },
+    { RClient::Depth, "depth", 0, CommandLineParser::Required, "Levels of callers or callees for --call-hierarchy, 0 for no limit (default 1)." },
     { RClient::ReverseSort, "reverse-sort", 'O', CommandLineParser::NoValue, "Sort output reversed." },
     { RClient::Rename, "rename", 0, CommandLineParser::NoValue, "Used for --references to indicate that we're using the results to rename symbols." },
     { RClient::UnsavedFile, "unsaved-file", 0, CommandLineParser::Required, "Pass unsaved file on command line. E.g. --unsaved-file=main.cpp:1200 then write 1200 bytes on stdin." },
@@ -135,6 +138,7 @@ std::initializer_list<CommandLineParser::Option<RClient::OptionType> > opts = {
     { RClient::Diagnostics, "diagnostics", 'm', CommandLineParser::NoValue, "Receive async formatted diagnostics from rdm." },
     { RClient::MatchRegex, "match-regexp", 'Z', CommandLineParser::NoValue, "Treat various text patterns as regexps (-P, -i, -V, -F)." },
     { RClient::MatchCaseInsensitive, "match-icase", 'I', CommandLineParser::NoValue, "Match case insensitively" },
+    { RClient::MatchFuzzy, "match-fuzzy", 0, CommandLineParser::NoValue, "Rank symbol names by fuzzy/camel hump matches for -F and -S, best first." },
     { RClient::AbsolutePath, "absolute-path", 'K', CommandLineParser::NoValue, "Print files with absolute path." },
     { RClient::SocketFile, "socket-file", 'n', CommandLineParser::Required, "Use this socket file (default ~/.rdm)." },
     { RClient::SocketAddress, "socket-address", 0, CommandLineParser::Required, "Use this host:port combination (instead of --socket-file)." },
@@ -217,6 +221,7 @@ public:
         msg.setUnsavedFiles(rc->unsavedFiles());
         msg.setFlags(extraQueryFlags | rc->queryFlags());
         msg.setMax(rc->max());
+        msg.setDepth(rc->depth());
         msg.setPathFilters(rc->pathFilters());
         msg.setKindFilters(rc->kindFilters());
         msg.setRangeFilter(rc->minOffset(), rc->maxOffset());
@@ -325,7 +330,7 @@ public:
 };
 
 RClient::RClient()
-    : mMax(-1), mTimeout(-1), mMinOffset(-1), mMaxOffset(-1),
+    : mMax(-1), mDepth(1), mTimeout(-1), mMinOffset(-1), mMaxOffset(-1),
       mConnectTimeout(DEFAULT_CONNECT_TIMEOUT), mBuildIndex(0),
       mLogLevel(LogLevel::Error), mTcpPort(0), mGuessFlags(false),
       mTerminalWidth(-1), mExitCode(RTags::ArgumentParseError)
@@ -577,6 +582,12 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
         case MatchRegex: {
             mQueryFlags |= QueryMessage::MatchRegex;
             break; }
+        case MatchFuzzy: {
+            mQueryFlags |= QueryMessage::MatchFuzzy;
+            break; }
+        case Callees: {
+            mQueryFlags |= QueryMessage::CallHierarchyCallees;
+            break; }
         case AbsolutePath: {
             mQueryFlags |= QueryMessage::AbsolutePath;
             break; }
@@ -696,6 +707,14 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
                 return { String::format<1024>("-M [arg] must be >= 0"), CommandLineParser::Parse_Error };
             }
             break; }
+        case Depth: {
+            bool ok;
+            const long depth = value.toLong(&ok);
+            if (!ok || depth < 0 || depth > INT_MAX) {
+                return { String::format<1024>("--depth [arg] must be >= 0"), CommandLineParser::Parse_Error };
+            }
+            mDepth = depth;
+            break; }
         case Timeout: {
             mTimeout = atoi(value.constData());
             if (!mTimeout) {
@@ -734,6 +753,7 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
             break; }
         case FollowLocation:
         case ClassHierarchy:
+        case CallHierarchy:
         case ReferenceLocation: {
             String encoded = Location::encode(value);
             if (encoded.isEmpty()) {
@@ -750,6 +770,9 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
             case ClassHierarchy:
                 queryType = QueryMessage::ClassHierarchy;
                 break;
+            case CallHierarchy:
+                queryType = QueryMessage::CallHierarchy;
+                break;
             default:
                 assert(0);
                 break;
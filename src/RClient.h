@@ -39,6 +39,8 @@ public:
         AllReferences,
         AllTargets,
         BuildIndex,
+        CallHierarchy,
+        Callees,
         CheckIncludes,
         CheckReindex,
         ClassHierarchy,
@@ -65,6 +67,7 @@ public:
         DeleteProject,
         Dependencies,
         DependencyFilter,
+        Depth,
         Diagnose,
         DiagnoseAll,
         Diagnostics,
@@ -102,6 +105,7 @@ public:
         Man,
         MatchCaseInsensitive,
         MatchRegex,
+        MatchFuzzy,
         Max,
         NoColor,
         NoContext,
@@ -166,6 +170,7 @@ public:
     CommandLineParser::ParseStatus parse(size_t argc, char **argv);
 
     int max() const { return mMax; }
+    int depth() const { return mDepth; }
     LogLevel logLevel() const { return mLogLevel; }
     int timeout() const { return mTimeout; }
     int buildIndex() const { return mBuildIndex; }
@@ -205,7 +210,7 @@ private:
     void addCompile(Path &&compileCommands);
 
     Flags<QueryMessage::Flag> mQueryFlags;
-    int mMax, mTimeout, mMinOffset, mMaxOffset, mConnectTimeout, mBuildIndex;
+    int mMax, mDepth, mTimeout, mMinOffset, mMaxOffset, mConnectTimeout, mBuildIndex;
     LogLevel mLogLevel;
     Set<QueryMessage::PathFilter> mPathFilters;
     QueryMessage::KindFilters mKindFilters;
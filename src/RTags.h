@@ -768,6 +768,22 @@ RCT_FLAGS(FindAncestorFlag);
 Path findAncestor(Path path, const String &fn, Flags<FindAncestorFlag> flags, SourceCache *cache = 0);
 Map<String, String> rtagsConfig(const Path &path, SourceCache *cache = 0);
 
+// FNV-1a, needs to be stable since these hashes end up on disk
+inline uint64_t hashUsr(const char *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i=0; i<size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t hashUsr(const String &usr)
+{
+    return hashUsr(usr.constData(), usr.size());
+}
+
 enum { DefinitionBit = 0x1000 };
 inline CXCursorKind targetsValueKind(uint16_t val)
 {
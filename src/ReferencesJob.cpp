@@ -64,9 +64,7 @@ int ReferencesJob::execute()
     const bool definitionOnly = queryFlags() & QueryMessage::DefinitionOnly;
     Location startLocation;
     bool first = true;
-    for (auto it = mLocations.begin(); it != mLocations.end(); ++it) {
-        const Location pos = *it;
-        Symbol sym = proj->findSymbol(pos);
+    for (Symbol sym : proj->findSymbols(mLocations)) {
         if (sym.isNull())
             continue;
         if (first && !(queryFlags() & QueryMessage::NoSortReferencesByInput)) {
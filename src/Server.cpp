@@ -24,6 +24,7 @@
 #include <limits>
 #include <regex>
 
+#include "CallHierarchyJob.h"
 #include "ClassHierarchyJob.h"
 #include "CompletionThread.h"
 #include "DependenciesJob.h"
@@ -783,6 +784,9 @@ void Server::handleQueryMessage(const std::shared_ptr<QueryMessage> &message, co
     case QueryMessage::ClassHierarchy:
         classHierarchy(message, conn);
         break;
+    case QueryMessage::CallHierarchy:
+        callHierarchy(message, conn);
+        break;
     case QueryMessage::DebugLocations:
         debugLocations(message, conn);
         break;
@@ -1926,6 +1930,32 @@ void Server::classHierarchy(const std::shared_ptr<QueryMessage> &query, const st
     conn->finish(job.run(conn));
 }
 
+void Server::callHierarchy(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
+{
+    const Location loc = query->location();
+    if (loc.isNull()) {
+        conn->write("Not indexed");
+        conn->finish(RTags::NotIndexed);
+        return;
+    }
+    std::shared_ptr<Project> project = projectForQuery(query);
+    if (!project) {
+        error("No project");
+        conn->write("Not indexed");
+        conn->finish(RTags::NotIndexed);
+        return;
+    }
+
+    if (!project->dependencies().contains(loc.fileId())) {
+        conn->write("Not indexed");
+        conn->finish(RTags::NotIndexed);
+        return;
+    }
+
+    CallHierarchyJob job(loc, query, project);
+    conn->finish(job.run(conn));
+}
+
 void Server::debugLocations(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
 {
     const String str = query->query();
@@ -2002,14 +2032,20 @@ void Server::handleVisitFileMessage(const std::shared_ptr<VisitFileMessage> &mes
     uint32_t fileId = 0;
     bool visit = false;
 
+    uint32_t generation = 0;
+    String digest;
+
     std::shared_ptr<Project> project = mProjects.value(message->project());
     const uint32_t id = message->sourceFileId();
     if (project && project->isActiveJob(id)) {
         assert(message->file() == message->file().resolved());
         fileId = Location::insertFile(message->file());
         visit = project->visitFile(fileId, message->file(), id);
+        if (visit)
+            digest = project->fileMapsDigest(fileId, &generation);
     }
     VisitFileResponseMessage msg(fileId, visit);
+    msg.setFileMaps(generation, digest);
     conn->send(msg);
 }
 
@@ -78,7 +78,6 @@ public:
         RPLogToSyslog = (1ull << 21),
         CompletionsNoFilter = (1ull << 22),
         WatchSourcesOnly = (1ull << 23),
-        NoFileLock = (1ull << 24),
         PCHEnabled = (1ull << 25),
         NoFileManager = (1ull << 26),
         ValidateFileMaps = (1ull << 27),
@@ -88,15 +87,16 @@ public:
         Separate32BitAnd64Bit = (1ull << 31),
         SourceIgnoreIncludePathDifferencesInUsr = (1ull << 32),
         NoLibClangIncludePath = (1ull << 33),
-        TranslationUnitCache = (1ull << 34)
+        TranslationUnitCache = (1ull << 34),
+        PackFileMaps = (1ull << 35)
     };
     struct Options {
         Options()
             : jobCount(0), headerErrorJobCount(0), maxIncludeCompletionDepth(0),
               rpVisitFileTimeout(0), rpIndexDataMessageTimeout(0), rpConnectTimeout(0),
               rpConnectAttempts(0), rpNiceValue(0), maxCrashCount(0),
-              completionCacheSize(0), testTimeout(60 * 1000 * 5),
-              maxFileMapScopeCacheSize(512), pollTimer(0), tcpPort(0)
+              completionCacheSize(0), testTimeout(60 * 1000 * 5), pollTimer(0),
+              fileMapCacheSize(256 * 1024 * 1024), tcpPort(0)
         {
         }
 
@@ -105,8 +105,8 @@ public:
         size_t jobCount, headerErrorJobCount, maxIncludeCompletionDepth;
         int rpVisitFileTimeout, rpIndexDataMessageTimeout,
             rpConnectTimeout, rpConnectAttempts, rpNiceValue, maxCrashCount,
-            completionCacheSize, testTimeout, maxFileMapScopeCacheSize, errorLimit,
-            pollTimer;
+            completionCacheSize, testTimeout, errorLimit, pollTimer;
+        size_t fileMapCacheSize;
         uint16_t tcpPort;
         List<String> defaultArguments, excludeFilters;
         Set<String> blockedArguments;
@@ -194,6 +194,7 @@ private:
     void suspend(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void setBuffers(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void classHierarchy(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
+    void callHierarchy(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void debugLocations(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void tokens(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void validate(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
@@ -169,17 +169,18 @@ int StatusJob::execute()
         write(delimiter);
         for (const auto &dep : deps) {
             auto targets = proj->openTargets(dep.first);
-            if (!targets)
+            auto collisions = proj->openTargetCollisions(dep.first);
+            if (!targets || !collisions)
                 continue;
-            const int count = targets->count();
-            for (int i=0; i<count; ++i) {
-                const String usr = targets->keyAt(i);
+            const uint32_t count = targets->count() + collisions->count();
+            for (uint32_t i=0; i<count; ++i) {
+                const String usr = proj->targetUsrAt(dep.first, i);
                 write<128>("  %s", usr.constData());
                 for (const auto &t : proj->findByUsr(usr, dep.first, Project::ArgDependsOn)) {
                     write<1024>("      %s\t%s", t.location.toString(locationToStringFlags()).constData(),
                                 t.kindSpelling().constData());
                 }
-                for (const auto &location : targets->valueAt(i)) {
+                for (const auto &location : proj->usrLocations(Project::Targets, dep.first, usr, RTags::hashUsr(usr))) {
                     write<1024>("    %s", location.toString(locationToStringFlags()).constData());
                 }
                 write("------------------------");
@@ -208,6 +209,20 @@ int StatusJob::execute()
                 if (isAborted())
                     return 1;
             }
+            auto suffixes = proj->openSymbolNameSuffixes(dep.first);
+            if (!suffixes)
+                continue;
+            const int suffixCount = suffixes->count();
+            String buffer;
+            for (int i=0; i<suffixCount; ++i) {
+                write<128>("  %s", suffixes->view(*symNames, i, buffer).toString().constData());
+                for (Location loc : symNames->valueAt(suffixes->at(i).name)) {
+                    write<1024>("    %s", loc.toString().constData());
+                }
+                write("------------------------");
+                if (isAborted())
+                    return 1;
+            }
         }
     }
 
@@ -0,0 +1,156 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef StringLocationBuilder_h
+#define StringLocationBuilder_h
+
+#include <assert.h>
+#include <algorithm>
+#include <limits>
+#include <unordered_set>
+
+#include "Location.h"
+#include "rct/List.h"
+#include "rct/String.h"
+#include "Sandbox.h"
+#include "SymbolNameSuffixes.h"
+
+/*
+ * Strings that are seen over and over while visiting a translation unit,
+ * e.g. usrs and symbol names, are stored once for the whole rp process.
+ * The pointers stay valid for the lifetime of the pool.
+ */
+class StringPool
+{
+public:
+    const String *intern(const String &string) { return &*mStrings.insert(string).first; }
+    size_t size() const { return mStrings.size(); }
+private:
+    std::unordered_set<String> mStrings;
+};
+
+/*
+ * Replaces Map<String, Set<Location> > while rp is visiting. Inserts only
+ * append an interned string and a location, the list is sorted and
+ * deduplicated once in build() which groups it into the sorted key/value
+ * pairs FileMap::encode() takes.
+ */
+class StringLocationBuilder
+{
+public:
+    typedef List<std::pair<String, List<Location> > > Result;
+
+    StringLocationBuilder(StringPool *pool)
+        : mPool(pool), mSorted(true)
+    {}
+
+    void insert(const String &string, Location location)
+    {
+        const String *interned = mPool->intern(string);
+        if (mSorted && !mEntries.isEmpty() && !(mEntries.last() < std::make_pair(interned, location)))
+            mSorted = false;
+        mEntries.append(std::make_pair(interned, location));
+    }
+
+    /*
+     * string.left(prefix) + string.mid(offset) is another name for the
+     * locations of string which has to be inserted as well. See
+     * SymbolNameSuffixes. The offsets are into the spelling so names with
+     * a sandbox root in them, e.g. "(lambda at /path...)", are inserted as
+     * they are.
+     */
+    void insertSuffix(const String &string, uint32_t prefix, uint32_t offset, Location location)
+    {
+        assert(prefix <= offset && offset <= string.size());
+        if (offset > std::numeric_limits<uint16_t>::max()
+            || (Sandbox::hasRoot() && string.contains(Sandbox::root()))) {
+            insert(string.left(prefix) + string.mid(offset), location);
+        } else {
+            mSuffixes.append(std::make_pair(mPool->intern(string), std::pair<uint16_t, uint16_t>(prefix, offset)));
+        }
+    }
+
+    size_t size() const { return mEntries.size() + mSuffixes.size(); }
+    bool isEmpty() const { return mEntries.isEmpty(); }
+
+    // strings are sandbox encoded when there's a sandbox root
+    Result build(List<SymbolNameSuffix> *suffixes = 0)
+    {
+        if (!mSorted) {
+            std::sort(mEntries.begin(), mEntries.end());
+            mEntries.erase(std::unique(mEntries.begin(), mEntries.end()), mEntries.end());
+            mSorted = true;
+        }
+
+        // entries are grouped by pointer now, sort the groups by string
+        const bool hasRoot = Sandbox::hasRoot();
+        Result ret;
+        const String *last = 0;
+        for (const auto &entry : mEntries) {
+            if (entry.first != last) {
+                ret.append(std::make_pair(hasRoot ? Sandbox::encoded(*entry.first) : *entry.first, List<Location>()));
+                last = entry.first;
+            }
+            ret.last().second.append(entry.second);
+        }
+        std::sort(ret.begin(), ret.end(), compareKeys);
+        if (suffixes)
+            buildSuffixes(ret, hasRoot, *suffixes);
+        return ret;
+    }
+private:
+    static bool compareKeys(const std::pair<String, List<Location> > &l, const std::pair<String, List<Location> > &r)
+    {
+        return l.first < r.first;
+    }
+
+    void buildSuffixes(const Result &names, bool hasRoot, List<SymbolNameSuffix> &suffixes)
+    {
+        std::sort(mSuffixes.begin(), mSuffixes.end());
+        mSuffixes.erase(std::unique(mSuffixes.begin(), mSuffixes.end()), mSuffixes.end());
+
+        List<std::pair<String, SymbolNameSuffix> > spelled;
+        spelled.reserve(mSuffixes.size());
+        std::pair<String, List<Location> > key;
+        for (const auto &suffix : mSuffixes) {
+            key.first = hasRoot ? Sandbox::encoded(*suffix.first) : *suffix.first;
+            // names with a sandbox root were inserted as they are
+            assert(key.first.size() == suffix.first->size());
+            const auto it = std::lower_bound(names.begin(), names.end(), key, compareKeys);
+            if (it == names.end() || it->first != key.first) {
+                assert(0 && "Suffix of a name that wasn't inserted");
+                continue;
+            }
+            const uint16_t prefix = suffix.second.first, offset = suffix.second.second;
+            spelled.append(std::make_pair(key.first.left(prefix) + key.first.mid(offset),
+                                          SymbolNameSuffix(it - names.begin(), prefix, offset)));
+        }
+        std::sort(spelled.begin(), spelled.end(), [](const std::pair<String, SymbolNameSuffix> &l,
+                                                     const std::pair<String, SymbolNameSuffix> &r) {
+                      return l.first < r.first;
+                  });
+        suffixes.clear();
+        suffixes.reserve(spelled.size());
+        for (const auto &suffix : spelled)
+            suffixes.append(suffix.second);
+    }
+
+    StringPool *mPool;
+    List<std::pair<const String *, Location> > mEntries;
+    List<std::pair<const String *, std::pair<uint16_t, uint16_t> > > mSuffixes;
+    bool mSorted;
+};
+
+#endif
@@ -20,6 +20,7 @@
 #include <memory>
 #include <stdint.h>
 
+#include "FileMap.h"
 #include "Location.h"
 #include "Sandbox.h"
 #include "rct/Flags.h"
@@ -178,6 +179,14 @@ struct Symbol
     static String kindSpelling(uint16_t kind);
 
     bool operator<(const Symbol &other) const { return location < other.location; }
+
+    // columns of the symbols file map, location is always set
+    enum Column {
+        Hot = 0x1, // kind, flags, length, extents and the other fixed size fields
+        Names = 0x2, // symbolName, usr and baseClasses
+        Details = 0x4, // typeName, arguments, argumentUsage and comments
+        AllColumns = Hot|Names|Details
+    };
 };
 
 RCT_FLAGS(Symbol::ToStringFlag);
@@ -248,6 +257,119 @@ template <> inline Deserializer &operator>>(Deserializer &s, Symbol &t)
     return s;
 }
 
+template <> struct FileMapColumns<Symbol>
+{
+    enum { Enabled = 1 };
+
+    struct HotColumn
+    {
+        int64_t enumValue;
+        int32_t startLine, endLine;
+        uint16_t symbolLength, kind, type, flags, size;
+        int16_t startColumn, endColumn, fieldOffset, alignment;
+        uint8_t linkage;
+        uint8_t reserved[5];
+    };
+    static_assert(sizeof(HotColumn) == 40, "Unexpected padding in HotColumn");
+
+    /*
+     * [HotColumn x count][names offset x count][details offset x count]
+     * [names data][details data]
+     */
+    template <typename Container>
+    static void encode(const Container &map, String &out)
+    {
+        const uint32_t count = map.size();
+        const uint32_t hotOffset = out.size();
+        const uint32_t namesOffsets = hotOffset + (count * sizeof(HotColumn));
+        const uint32_t detailsOffsets = namesOffsets + (count * sizeof(uint32_t));
+        out.resize(detailsOffsets + (count * sizeof(uint32_t)));
+
+        String details;
+        Serializer detailsSerializer(details);
+        List<uint32_t> detailsPositions;
+        detailsPositions.reserve(count);
+        Serializer serializer(out);
+        uint32_t idx = 0;
+        for (const auto &pair : map) {
+            const Symbol &symbol = pair.second;
+            HotColumn hot;
+            memset(&hot, 0, sizeof(hot));
+            hot.enumValue = symbol.enumValue;
+            hot.startLine = symbol.startLine;
+            hot.endLine = symbol.endLine;
+            hot.symbolLength = symbol.symbolLength;
+            hot.kind = static_cast<uint16_t>(symbol.kind);
+            hot.type = static_cast<uint16_t>(symbol.type);
+            hot.flags = symbol.flags;
+            hot.size = symbol.size;
+            hot.startColumn = symbol.startColumn;
+            hot.endColumn = symbol.endColumn;
+            hot.fieldOffset = symbol.fieldOffset;
+            hot.alignment = symbol.alignment;
+            hot.linkage = static_cast<uint8_t>(symbol.linkage);
+            memcpy(out.data() + hotOffset + (idx * sizeof(HotColumn)), &hot, sizeof(hot));
+
+            const uint32_t pos = out.size();
+            memcpy(out.data() + namesOffsets + (idx * sizeof(uint32_t)), &pos, sizeof(pos));
+            serializer << symbol.symbolName << symbol.usr << symbol.baseClasses;
+
+            detailsPositions.append(details.size());
+            detailsSerializer << symbol.typeName << symbol.arguments << symbol.argumentUsage
+                              << symbol.briefComment << symbol.xmlComment;
+            ++idx;
+        }
+        const uint32_t detailsOffset = out.size();
+        for (uint32_t i=0; i<count; ++i) {
+            const uint32_t pos = detailsOffset + detailsPositions.at(i);
+            memcpy(out.data() + detailsOffsets + (i * sizeof(uint32_t)), &pos, sizeof(pos));
+        }
+        out.append(details);
+    }
+
+    static void decode(Symbol &symbol, const char *base, const char *values, uint32_t count, uint32_t index, uint32_t columns)
+    {
+        if (columns & Symbol::Hot) {
+            HotColumn hot;
+            memcpy(&hot, values + (index * sizeof(HotColumn)), sizeof(hot));
+            symbol.enumValue = hot.enumValue;
+            symbol.startLine = hot.startLine;
+            symbol.endLine = hot.endLine;
+            symbol.symbolLength = hot.symbolLength;
+            symbol.kind = static_cast<CXCursorKind>(hot.kind);
+            symbol.type = static_cast<CXTypeKind>(hot.type);
+            symbol.flags = hot.flags;
+            symbol.size = hot.size;
+            symbol.startColumn = hot.startColumn;
+            symbol.endColumn = hot.endColumn;
+            symbol.fieldOffset = hot.fieldOffset;
+            symbol.alignment = hot.alignment;
+            symbol.linkage = static_cast<CXLinkageKind>(hot.linkage);
+        }
+        const char *offsets = values + (count * sizeof(HotColumn));
+        uint32_t offset;
+        if (columns & Symbol::Names) {
+            memcpy(&offset, offsets + (index * sizeof(uint32_t)), sizeof(offset));
+            Deserializer deserializer(base + offset, INT_MAX);
+            deserializer >> symbol.symbolName >> symbol.usr >> symbol.baseClasses;
+            Sandbox::decode(symbol.symbolName);
+            Sandbox::decode(symbol.usr);
+        }
+        if (columns & Symbol::Details) {
+            offsets += count * sizeof(uint32_t);
+            memcpy(&offset, offsets + (index * sizeof(uint32_t)), sizeof(offset));
+            Deserializer deserializer(base + offset, INT_MAX);
+            deserializer >> symbol.typeName >> symbol.arguments >> symbol.argumentUsage
+                         >> symbol.briefComment >> symbol.xmlComment;
+            Sandbox::decode(symbol.typeName);
+            Sandbox::decode(symbol.briefComment);
+            Sandbox::decode(symbol.xmlComment);
+        }
+    }
+
+    static void setKey(Symbol &symbol, Location location) { symbol.location = location; }
+};
+
 static inline Log operator<<(Log dbg, const Symbol &symbol)
 {
     const String out = "Symbol(" + symbol.toString() + ")";
@@ -0,0 +1,637 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "SymbolNameIndex.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+#include <queue>
+
+#include "rct/EventLoop.h"
+
+static inline int compare(const FileMapString &l, const FileMapString &r)
+{
+    const int cmp = memcmp(l.data(), r.data(), std::min(l.size(), r.size()));
+    if (cmp)
+        return cmp;
+    if (l.size() < r.size())
+        return -1;
+    return l.size() > r.size() ? 1 : 0;
+}
+
+static inline unsigned char fold(char ch)
+{
+    return static_cast<unsigned char>(tolower(static_cast<unsigned char>(ch)));
+}
+
+static inline int foldedCompare(const FileMapString &l, const FileMapString &r)
+{
+    const uint32_t size = std::min(l.size(), r.size());
+    for (uint32_t i=0; i<size; ++i) {
+        if (const int cmp = fold(l.data()[i]) - fold(r.data()[i]))
+            return cmp;
+    }
+    if (l.size() < r.size())
+        return -1;
+    return l.size() > r.size() ? 1 : 0;
+}
+
+static inline uint32_t trigram(const char *data)
+{
+    return (static_cast<uint32_t>(fold(data[0])) << 16) | (static_cast<uint32_t>(fold(data[1])) << 8) | fold(data[2]);
+}
+
+uint64_t SymbolNameIndex::characters(const char *data, uint32_t size)
+{
+    uint64_t ret = 0;
+    for (uint32_t i=0; i<size; ++i) {
+        const unsigned char ch = fold(data[i]);
+        if (ch >= 'a' && ch <= 'z') {
+            ret |= 1ull << (ch - 'a');
+        } else if (ch >= '0' && ch <= '9') {
+            ret |= 1ull << (26 + ch - '0');
+        } else {
+            ret |= 1ull << (36 + (ch % 28));
+        }
+    }
+    return ret;
+}
+
+SymbolNameIndex::SymbolNameIndex()
+    : mNextRunId(0), mGeneration(0), mCompacting(false)
+{
+}
+
+void SymbolNameIndex::insert(const Hash<uint32_t, List<String> > &files)
+{
+    if (files.isEmpty())
+        return;
+
+    List<std::pair<const String *, uint32_t> > sorted;
+    for (const auto &file : files) {
+        for (const String &name : file.second)
+            sorted.append(std::make_pair(&name, file.first));
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<const String *, uint32_t> &l,
+                                               const std::pair<const String *, uint32_t> &r) {
+                  const int cmp = l.first->compare(*r.first);
+                  return cmp < 0 || (!cmp && l.second < r.second);
+              });
+
+    std::shared_ptr<Run> run = std::make_shared<Run>();
+    run->id = ++mNextRunId;
+    run->entries.reserve(sorted.size());
+    for (const auto &file : files)
+        run->files[file.first] = 0;
+    const std::pair<const String *, uint32_t> *last = 0;
+    for (const auto &name : sorted) {
+        if (last && *last->first == *name.first && last->second == name.second)
+            continue;
+        last = &name;
+        const Entry entry = { static_cast<uint32_t>(run->names.size()), static_cast<uint32_t>(name.first->size()), name.second };
+        run->names.append(*name.first);
+        run->entries.append(entry);
+        ++run->files[name.second];
+    }
+
+    for (const auto &file : files) {
+        remove(file.first);
+        mFiles[file.first] = run->id;
+    }
+    mRuns.append(run);
+    startCompaction();
+}
+
+void SymbolNameIndex::remove(uint32_t fileId)
+{
+    const auto it = mFiles.find(fileId);
+    if (it == mFiles.end())
+        return;
+    if (const Run *r = run(it->second))
+        mDead[r->id] += r->files.value(fileId);
+    mFiles.erase(it);
+}
+
+void SymbolNameIndex::clear()
+{
+    mRuns.clear();
+    mFiles.clear();
+    mDead.clear();
+    // a running compaction is ignored when it finishes
+    ++mGeneration;
+}
+
+size_t SymbolNameIndex::memory() const
+{
+    size_t ret = sizeof(SymbolNameIndex) + (mFiles.size() * sizeof(uint32_t) * 2);
+    for (const auto &run : mRuns) {
+        ret += sizeof(Run) + run->names.size() + (run->entries.size() * sizeof(Entry)) + (run->files.size() * sizeof(uint32_t) * 2);
+        ret += run->folded.size() * sizeof(uint32_t);
+        ret += (run->sized.size() * sizeof(uint32_t)) + (run->masks.size() * sizeof(uint64_t));
+        for (const auto &postings : run->trigrams)
+            ret += sizeof(uint32_t) + sizeof(Run::Postings) + postings.second.data.size();
+    }
+    return ret;
+}
+
+uint32_t SymbolNameIndex::Run::lowerBound(const String &name) const
+{
+    uint32_t lower = 0, upper = entries.size();
+    while (lower < upper) {
+        const uint32_t mid = lower + ((upper - lower) / 2);
+        if (this->name(entries[mid]).compare(name) < 0) {
+            lower = mid + 1;
+        } else {
+            upper = mid;
+        }
+    }
+    return lower;
+}
+
+uint32_t SymbolNameIndex::Run::foldedLowerBound(const String &name) const
+{
+    const FileMapString key(name.constData(), name.size());
+    uint32_t lower = 0, upper = folded.size();
+    while (lower < upper) {
+        const uint32_t mid = lower + ((upper - lower) / 2);
+        if (foldedCompare(this->name(folded[mid]), key) < 0) {
+            lower = mid + 1;
+        } else {
+            upper = mid;
+        }
+    }
+    return lower;
+}
+
+void SymbolNameIndex::Run::buildSearchTables()
+{
+    const uint32_t count = entries.size();
+    folded.resize(count);
+    for (uint32_t i=0; i<count; ++i)
+        folded[i] = i;
+    std::stable_sort(folded.begin(), folded.end(), [this](uint32_t l, uint32_t r) {
+            return foldedCompare(name(l), name(r)) < 0;
+        });
+    sizeOrder(sized, masks);
+
+    trigrams.clear();
+    List<uint32_t> grams;
+    for (uint32_t i=0; i<count; ++i) {
+        const FileMapString n = name(i);
+        grams.clear();
+        for (uint32_t j=0; j + 3 <= n.size(); ++j)
+            grams.append(trigram(n.data() + j));
+        std::sort(grams.begin(), grams.end());
+        grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+        for (uint32_t gram : grams) {
+            Postings &postings = trigrams[gram];
+            FileMapFrontCoding<String>::writeVarint(postings.data, i - postings.last);
+            postings.last = i;
+            ++postings.count;
+        }
+    }
+    hasSearchTables = true;
+}
+
+void SymbolNameIndex::Run::sizeOrder(List<uint32_t> &sized, List<uint64_t> &masks) const
+{
+    const uint32_t count = entries.size();
+    sized.resize(count);
+    for (uint32_t i=0; i<count; ++i)
+        sized[i] = i;
+    std::stable_sort(sized.begin(), sized.end(), [this](uint32_t l, uint32_t r) {
+            return entries[l].size < entries[r].size;
+        });
+    masks.resize(count);
+    for (uint32_t i=0; i<count; ++i)
+        masks[i] = SymbolNameIndex::characters(names.constData() + entries[i].offset, entries[i].size);
+}
+
+static void decodePostings(const String &data, List<uint32_t> &indexes)
+{
+    indexes.clear();
+    const char *pos = data.constData();
+    const char *end = pos + data.size();
+    uint32_t index = 0;
+    while (pos < end) {
+        uint32_t delta;
+        pos = FileMapFrontCoding<String>::readVarint(pos, delta);
+        index += delta;
+        indexes.append(index);
+    }
+}
+
+List<uint32_t> SymbolNameIndex::Run::candidates(const List<String> &substrings) const
+{
+    List<const Postings *> lists;
+    for (const String &substring : substrings) {
+        for (size_t i=0; i + 3 <= substring.size(); ++i) {
+            const auto it = trigrams.find(trigram(substring.constData() + i));
+            if (it == trigrams.end())
+                return List<uint32_t>();
+            lists.append(&it->second);
+        }
+    }
+    assert(!lists.isEmpty());
+    // intersect starting with the shortest list
+    std::sort(lists.begin(), lists.end(), [](const Postings *l, const Postings *r) { return l->count < r->count; });
+    lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+
+    List<uint32_t> ret, other, intersection;
+    decodePostings(lists.front()->data, ret);
+    for (size_t i=1; i<lists.size() && !ret.isEmpty(); ++i) {
+        decodePostings(lists[i]->data, other);
+        intersection.clear();
+        std::set_intersection(ret.begin(), ret.end(), other.begin(), other.end(), std::back_inserter(intersection));
+        std::swap(ret, intersection);
+    }
+    return ret;
+}
+
+void SymbolNameIndex::find(const String &lowerBound, const std::function<int(const FileMapString &, uint32_t)> &visitor) const
+{
+    for (const auto &run : mRuns) {
+        const uint32_t count = run->entries.size();
+        for (uint32_t i=lowerBound.isEmpty() ? 0 : run->lowerBound(lowerBound); i<count; ++i) {
+            const Entry &entry = run->entries[i];
+            if (mFiles.value(entry.fileId) != run->id)
+                continue;
+            if (visitor(run->name(entry), entry.fileId) < 0)
+                break;
+        }
+    }
+}
+
+void SymbolNameIndex::findCaseInsensitive(const String &prefix, const std::function<int(const FileMapString &, uint32_t)> &visitor) const
+{
+    for (const auto &run : mRuns) {
+        if (!run->hasSearchTables) {
+            // not in folded order, -1 doesn't tell us anything
+            for (const Entry &entry : run->entries) {
+                const FileMapString name = run->name(entry);
+                if (mFiles.value(entry.fileId) == run->id && name.startsWith(prefix, String::CaseInsensitive))
+                    visitor(name, entry.fileId);
+            }
+            continue;
+        }
+        const uint32_t count = run->folded.size();
+        for (uint32_t i=prefix.isEmpty() ? 0 : run->foldedLowerBound(prefix); i<count; ++i) {
+            const Entry &entry = run->entries[run->folded[i]];
+            const FileMapString name = run->name(entry);
+            if (!name.startsWith(prefix, String::CaseInsensitive))
+                break;
+            if (mFiles.value(entry.fileId) != run->id)
+                continue;
+            if (visitor(name, entry.fileId) < 0)
+                break;
+        }
+    }
+}
+
+void SymbolNameIndex::findSubstrings(const List<String> &substrings, const std::function<int(const FileMapString &, uint32_t)> &visitor) const
+{
+    bool trigrams = false;
+    for (const String &substring : substrings) {
+        if (substring.size() >= 3) {
+            trigrams = true;
+            break;
+        }
+    }
+    if (!trigrams) {
+        find(String(), visitor);
+        return;
+    }
+
+    for (const auto &run : mRuns) {
+        List<uint32_t> candidates;
+        if (run->hasSearchTables) {
+            candidates = run->candidates(substrings);
+        } else {
+            candidates.resize(run->entries.size());
+            for (uint32_t i=0; i<candidates.size(); ++i)
+                candidates[i] = i;
+        }
+        for (uint32_t index : candidates) {
+            const Entry &entry = run->entries[index];
+            if (mFiles.value(entry.fileId) != run->id)
+                continue;
+            if (visitor(run->name(entry), entry.fileId) < 0)
+                break;
+        }
+    }
+}
+
+void SymbolNameIndex::findBySize(uint64_t characters, const std::function<int(const FileMapString &, uint32_t)> &visitor) const
+{
+    // runs without search tables are put in order of size here
+    List<std::pair<List<uint32_t>, List<uint64_t> > > unsorted;
+    unsorted.reserve(mRuns.size());
+    List<const List<uint32_t> *> sized(mRuns.size());
+    List<const List<uint64_t> *> masks(mRuns.size());
+    for (size_t i=0; i<mRuns.size(); ++i) {
+        if (mRuns[i]->hasSearchTables) {
+            sized[i] = &mRuns[i]->sized;
+            masks[i] = &mRuns[i]->masks;
+        } else {
+            unsorted.append(std::pair<List<uint32_t>, List<uint64_t> >());
+            mRuns[i]->sizeOrder(unsorted.last().first, unsorted.last().second);
+            sized[i] = &unsorted.last().first;
+            masks[i] = &unsorted.last().second;
+        }
+    }
+
+    // position in the sized list of each run, the heap has the run with the
+    // shortest name on top
+    List<uint32_t> positions(mRuns.size(), 0);
+    auto greater = [this, &positions, &sized](size_t l, size_t r) {
+        return mRuns[l]->entries[(*sized[l])[positions[l]]].size > mRuns[r]->entries[(*sized[r])[positions[r]]].size;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+    for (size_t i=0; i<mRuns.size(); ++i) {
+        if (!sized[i]->isEmpty())
+            heap.push(i);
+    }
+    while (!heap.empty()) {
+        const size_t idx = heap.top();
+        heap.pop();
+        const Run &run = *mRuns[idx];
+        const uint32_t index = (*sized[idx])[positions[idx]];
+        const Entry &entry = run.entries[index];
+        if (((*masks[idx])[index] & characters) == characters && mFiles.value(entry.fileId) == run.id) {
+            if (visitor(run.name(entry), entry.fileId) < 0)
+                return;
+        }
+        if (++positions[idx] < sized[idx]->size())
+            heap.push(idx);
+    }
+}
+
+const SymbolNameIndex::Run *SymbolNameIndex::run(uint32_t id) const
+{
+    for (const auto &run : mRuns) {
+        if (run->id == id)
+            return run.get();
+    }
+    return 0;
+}
+
+void SymbolNameIndex::startCompaction()
+{
+    if (mCompacting || mRuns.isEmpty())
+        return;
+
+    // merge the newest runs for as long as the next older run isn't much
+    // bigger than what we have, like adding to a binary counter
+    const size_t last = mRuns.size() - 1;
+    size_t first = last;
+    uint32_t total = liveCount(*mRuns[last]);
+    while (first > 0 && liveCount(*mRuns[first - 1]) <= total * 2) {
+        --first;
+        total += liveCount(*mRuns[first]);
+    }
+    size_t end = last;
+    if (first == last) {
+        if (mRuns.size() > MaxRuns) {
+            first = last - 1;
+        } else {
+            // rewrite a run that doesn't have its search tables yet or is
+            // mostly dead names
+            first = 0;
+            while (first < mRuns.size() && mRuns[first]->hasSearchTables
+                   && mDead.value(mRuns[first]->id) * 2 <= mRuns[first]->entries.size()) {
+                ++first;
+            }
+            if (first == mRuns.size())
+                return;
+            end = first;
+        }
+    }
+
+    List<std::shared_ptr<const Run> > runs;
+    List<uint32_t> ids;
+    Hash<uint32_t, uint32_t> live;
+    for (size_t i=first; i<=end; ++i) {
+        runs.append(mRuns[i]);
+        ids.append(mRuns[i]->id);
+        for (const auto &file : mRuns[i]->files) {
+            if (mFiles.value(file.first) == mRuns[i]->id)
+                live[file.first] = mRuns[i]->id;
+        }
+    }
+
+    mCompacting = true;
+    CompactionThread *thread = new CompactionThread(std::move(runs), std::move(live));
+    thread->setAutoDelete(true);
+    std::weak_ptr<SymbolNameIndex> that = shared_from_this();
+    const uint32_t generation = mGeneration;
+    thread->finished().connect<EventLoop::Move>([that, generation, ids](const std::shared_ptr<Run> &run) {
+            if (auto strong = that.lock())
+                strong->onCompactionFinished(generation, ids, run);
+        });
+    thread->start();
+}
+
+void SymbolNameIndex::onCompactionFinished(uint32_t generation, const List<uint32_t> &ids, const std::shared_ptr<Run> &run)
+{
+    assert(mCompacting);
+    mCompacting = false;
+    if (generation != mGeneration)
+        return;
+
+    // runs are only added at the end while compacting so the merged ones are
+    // still next to each other
+    size_t first = 0;
+    while (first < mRuns.size() && mRuns[first]->id != ids.front())
+        ++first;
+    assert(first + ids.size() <= mRuns.size());
+    assert(mRuns[first + ids.size() - 1]->id == ids.back());
+
+    run->id = ++mNextRunId;
+    for (const auto &file : run->files) {
+        auto it = mFiles.find(file.first);
+        if (it != mFiles.end() && std::find(ids.begin(), ids.end(), it->second) != ids.end()) {
+            it->second = run->id;
+        } else {
+            // inserted or removed since the compaction started
+            mDead[run->id] += file.second;
+        }
+    }
+    for (uint32_t id : ids)
+        mDead.remove(id);
+    mRuns.erase(mRuns.begin() + first, mRuns.begin() + first + ids.size());
+    if (!run->entries.isEmpty() || !run->files.isEmpty())
+        mRuns.insert(mRuns.begin() + first, run);
+    startCompaction();
+}
+
+std::shared_ptr<SymbolNameIndex::Run> SymbolNameIndex::merge(const List<std::shared_ptr<const Run> > &runs,
+                                                             const Hash<uint32_t, uint32_t> &live)
+{
+    std::shared_ptr<Run> ret = std::make_shared<Run>();
+    size_t count = 0, size = 0;
+    for (const auto &run : runs) {
+        count += run->entries.size();
+        size += run->names.size();
+    }
+    ret->entries.reserve(count);
+    ret->names.reserve(size);
+
+    // position in each run, the heap has the run with the smallest name on top
+    List<uint32_t> positions(runs.size(), 0);
+    auto greater = [&runs, &positions](size_t l, size_t r) {
+        const Entry &left = runs[l]->entries[positions[l]];
+        const Entry &right = runs[r]->entries[positions[r]];
+        const int cmp = compare(runs[l]->name(left), runs[r]->name(right));
+        return cmp > 0 || (!cmp && left.fileId > right.fileId);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+    for (size_t i=0; i<runs.size(); ++i) {
+        if (!runs[i]->entries.isEmpty())
+            heap.push(i);
+    }
+    while (!heap.empty()) {
+        const size_t idx = heap.top();
+        heap.pop();
+        const Run &run = *runs[idx];
+        const Entry &entry = run.entries[positions[idx]];
+        if (live.value(entry.fileId) == run.id) {
+            const Entry copy = { static_cast<uint32_t>(ret->names.size()), entry.size, entry.fileId };
+            ret->names.append(run.names.constData() + entry.offset, entry.size);
+            ret->entries.append(copy);
+            ++ret->files[entry.fileId];
+        }
+        if (++positions[idx] < run.entries.size())
+            heap.push(idx);
+    }
+    // files without any names still need to be known
+    for (const auto &file : live) {
+        if (!ret->files.contains(file.first))
+            ret->files[file.first] = 0;
+    }
+    ret->buildSearchTables();
+    return ret;
+}
+
+SymbolNameIndex::CompactionThread::CompactionThread(List<std::shared_ptr<const Run> > &&runs, Hash<uint32_t, uint32_t> &&live)
+    : mRuns(std::move(runs)), mLive(std::move(live))
+{
+}
+
+void SymbolNameIndex::CompactionThread::run()
+{
+    mFinished(merge(mRuns, mLive));
+}
+
+void SymbolNameIndex::encode(Serializer &s) const
+{
+    // every count is written before what it counts so decode() can check it
+    s << static_cast<uint32_t>(Version) << mNextRunId << static_cast<uint32_t>(mFiles.size());
+    for (const auto &file : mFiles)
+        s << file.first << file.second;
+    s << static_cast<uint32_t>(mRuns.size());
+    for (const auto &run : mRuns) {
+        s << run->id << static_cast<uint32_t>(run->names.size());
+        s.write(run->names.constData(), run->names.size());
+        s << static_cast<uint32_t>(run->files.size());
+        for (const auto &file : run->files)
+            s << file.first << file.second;
+        s << static_cast<uint32_t>(run->entries.size());
+        if (!run->entries.isEmpty())
+            s.write(reinterpret_cast<const char *>(&run->entries[0]), run->entries.size() * sizeof(Entry));
+    }
+}
+
+bool SymbolNameIndex::decode(Deserializer &s, size_t size)
+{
+    clear();
+    // every count and every name is checked against what's there so a
+    // damaged file fails instead of handing out names past the run
+    size_t remaining = size;
+    auto consume = [&remaining](size_t bytes) {
+        if (bytes > remaining)
+            return false;
+        remaining -= bytes;
+        return true;
+    };
+    auto fail = [this]() {
+        clear();
+        return false;
+    };
+    uint32_t version, count;
+    if (!consume(sizeof(uint32_t) * 3))
+        return false;
+    s >> version;
+    if (version != Version)
+        return false;
+    s >> mNextRunId >> count;
+    if (!consume(static_cast<size_t>(count) * sizeof(uint32_t) * 2))
+        return fail();
+    for (uint32_t i=0; i<count; ++i) {
+        uint32_t fileId, runId;
+        s >> fileId >> runId;
+        mFiles[fileId] = runId;
+    }
+    if (!consume(sizeof(uint32_t)))
+        return fail();
+    s >> count;
+    for (uint32_t i=0; i<count; ++i) {
+        std::shared_ptr<Run> run = std::make_shared<Run>();
+        uint32_t namesSize, fileCount, entries;
+        if (!consume(sizeof(uint32_t) * 2))
+            return fail();
+        s >> run->id >> namesSize;
+        if (!consume(namesSize))
+            return fail();
+        run->names.resize(namesSize);
+        if (namesSize)
+            s.read(run->names.data(), namesSize);
+        if (!consume(sizeof(uint32_t)))
+            return fail();
+        s >> fileCount;
+        if (!consume(static_cast<size_t>(fileCount) * sizeof(uint32_t) * 2))
+            return fail();
+        size_t names = 0;
+        for (uint32_t j=0; j<fileCount; ++j) {
+            uint32_t fileId, fileNames;
+            s >> fileId >> fileNames;
+            run->files[fileId] = fileNames;
+            names += fileNames;
+        }
+        if (!consume(sizeof(uint32_t)))
+            return fail();
+        s >> entries;
+        if (names != entries || !consume(static_cast<size_t>(entries) * sizeof(Entry)))
+            return fail();
+        run->entries.resize(entries);
+        if (entries)
+            s.read(reinterpret_cast<char *>(&run->entries[0]), entries * sizeof(Entry));
+        for (const Entry &entry : run->entries) {
+            if (entry.offset > run->names.size() || entry.size > run->names.size() - entry.offset)
+                return fail();
+        }
+        for (const auto &file : run->files) {
+            if (mFiles.value(file.first) != run->id)
+                mDead[run->id] += file.second;
+        }
+        mRuns.append(run);
+    }
+    if (remaining)
+        return fail();
+    startCompaction();
+    return true;
+}
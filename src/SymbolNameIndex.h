@@ -0,0 +1,165 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef SymbolNameIndex_h
+#define SymbolNameIndex_h
+
+#include <functional>
+#include <memory>
+
+#include "FileMap.h"
+#include "rct/Hash.h"
+#include "rct/List.h"
+#include "rct/Serializer.h"
+#include "rct/SignalSlot.h"
+#include "rct/String.h"
+#include "rct/Thread.h"
+
+/*
+ * Project wide index from symbol names to the files that have them, so name
+ * queries don't have to open the symnames map of every file.
+ *
+ * The index is a list of sorted runs. Every batch of indexed files becomes a
+ * new run and the names a file had in older runs are dead from then on,
+ * mFiles knows which run has the live names of each file. Adjacent runs of
+ * similar size are merged by a background thread which also drops the dead
+ * names, so there are only a few runs to search.
+ *
+ * Each run also has its names in case folded order for case insensitive
+ * prefix queries and posting lists of the case folded trigrams of the names
+ * to narrow down the candidates for substring, wildcard and regex queries.
+ * For fuzzy queries the names are in order of size as well with a mask of
+ * the characters each of them has. These search tables are only built by
+ * the background thread, new runs and runs that were just restored are
+ * scanned until it got to them.
+ */
+class SymbolNameIndex : public std::enable_shared_from_this<SymbolNameIndex>
+{
+public:
+    SymbolNameIndex();
+
+    enum {
+        Version = 2,
+        MaxRuns = 8
+    };
+
+    // the names replace the ones the index had for each of the files
+    void insert(const Hash<uint32_t, List<String> > &files);
+    void remove(uint32_t fileId);
+    void clear();
+
+    bool contains(uint32_t fileId) const { return mFiles.contains(fileId); }
+    size_t fileCount() const { return mFiles.size(); }
+    size_t runCount() const { return mRuns.size(); }
+    size_t memory() const;
+
+    /*
+     * Calls visitor for the live names >= lowerBound of each run in order.
+     * visitor returns 1 for a match, 0 for no match and -1 when no later name
+     * in the run can match.
+     */
+    void find(const String &lowerBound, const std::function<int(const FileMapString &, uint32_t)> &visitor) const;
+    // like find() for the names that start with prefix ignoring case, in case folded order
+    void findCaseInsensitive(const String &prefix, const std::function<int(const FileMapString &, uint32_t)> &visitor) const;
+    /*
+     * Calls visitor for the live names that might contain all the substrings,
+     * ignoring case. The visitor has to check the names, the substrings
+     * shorter than a trigram don't narrow anything down.
+     */
+    void findSubstrings(const List<String> &substrings, const std::function<int(const FileMapString &, uint32_t)> &visitor) const;
+    /*
+     * Calls visitor for the live names that have all the characters of
+     * characters(), shortest names first. visitor returns -1 when no longer
+     * name can match.
+     */
+    void findBySize(uint64_t characters, const std::function<int(const FileMapString &, uint32_t)> &visitor) const;
+
+    // case folded characters of the string as a bit mask
+    static uint64_t characters(const char *data, uint32_t size);
+
+    void encode(Serializer &s) const;
+    // size is the number of bytes encode() wrote, anything else fails
+    bool decode(Deserializer &s, size_t size);
+private:
+    struct Entry {
+        uint32_t offset, size, fileId;
+    };
+
+    struct Run {
+        Run()
+            : id(0), hasSearchTables(false)
+        {}
+
+        uint32_t id;
+        bool hasSearchTables;
+        String names;
+        List<Entry> entries; // sorted by name
+        Hash<uint32_t, uint32_t> files; // fileId -> number of names
+
+        // delta and varint encoded indexes in entries
+        struct Postings {
+            Postings()
+                : count(0), last(0)
+            {}
+
+            uint32_t count, last;
+            String data;
+        };
+        // entry indexes in case folded order
+        List<uint32_t> folded;
+        Hash<uint32_t, Postings> trigrams;
+        // entry indexes in order of size and the characters() of each entry
+        List<uint32_t> sized;
+        List<uint64_t> masks;
+
+        FileMapString name(const Entry &entry) const { return FileMapString(names.constData() + entry.offset, entry.size); }
+        FileMapString name(uint32_t index) const { return name(entries[index]); }
+        uint32_t lowerBound(const String &name) const;
+        uint32_t foldedLowerBound(const String &name) const;
+        void buildSearchTables();
+        // entry indexes in order of size and their characters()
+        void sizeOrder(List<uint32_t> &sized, List<uint64_t> &masks) const;
+        List<uint32_t> candidates(const List<String> &substrings) const;
+    };
+
+    class CompactionThread : public Thread
+    {
+    public:
+        CompactionThread(List<std::shared_ptr<const Run> > &&runs, Hash<uint32_t, uint32_t> &&live);
+        virtual void run() override;
+
+        Signal<std::function<void(std::shared_ptr<Run>)> > &finished() { return mFinished; }
+    private:
+        const List<std::shared_ptr<const Run> > mRuns;
+        // fileId -> id of the run with its live names
+        const Hash<uint32_t, uint32_t> mLive;
+        Signal<std::function<void(std::shared_ptr<Run>)> > mFinished;
+    };
+
+    static std::shared_ptr<Run> merge(const List<std::shared_ptr<const Run> > &runs, const Hash<uint32_t, uint32_t> &live);
+    const Run *run(uint32_t id) const;
+    uint32_t liveCount(const Run &run) const { return run.entries.size() - mDead.value(run.id); }
+    void startCompaction();
+    void onCompactionFinished(uint32_t generation, const List<uint32_t> &ids, const std::shared_ptr<Run> &run);
+
+    List<std::shared_ptr<const Run> > mRuns;
+    Hash<uint32_t, uint32_t> mFiles;
+    // run id -> number of dead names in the run
+    Hash<uint32_t, uint32_t> mDead;
+    uint32_t mNextRunId, mGeneration;
+    bool mCompacting;
+};
+
+#endif
@@ -0,0 +1,152 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef SymbolNameSuffixes_h
+#define SymbolNameSuffixes_h
+
+#include <assert.h>
+#include <string.h>
+#include <memory>
+
+#include "FileMap.h"
+#include "rct/List.h"
+#include "rct/String.h"
+
+/*
+ * The symbol names map only has the fully qualified names, e.g.
+ * "int a::b::foo(int)". The less qualified permutations ("b::foo(int)",
+ * "int foo(int)", ...) are entries that point into one of those names.
+ * The permutation is the first prefix bytes of the name (the type) followed
+ * by the name from offset on.
+ */
+struct SymbolNameSuffix
+{
+    SymbolNameSuffix(uint32_t n = 0, uint16_t p = 0, uint16_t o = 0)
+        : name(n), prefix(p), offset(o)
+    {}
+
+    uint32_t name; // index in the symbol names map
+    uint16_t prefix, offset;
+
+    bool operator==(const SymbolNameSuffix &other) const
+    {
+        return name == other.name && prefix == other.prefix && offset == other.offset;
+    }
+};
+
+static_assert(sizeof(SymbolNameSuffix) == 8, "SymbolNameSuffix should be 8 bytes");
+
+/*
+ * The suffixes of one file, sorted by the permutation they spell so lookups
+ * can binary search them like the symbol names map.
+ */
+class SymbolNameSuffixes
+{
+public:
+    SymbolNameSuffixes()
+        : mPointer(0), mCount(0)
+    {}
+
+    enum {
+        Magic = 0x78664e53,
+        Version = 1,
+        HeaderSize = sizeof(uint32_t) * 3
+    };
+
+    bool init(const char *pointer, uint32_t size, const std::shared_ptr<void> &owner = std::shared_ptr<void>(), String *error = 0)
+    {
+        uint32_t header[HeaderSize / sizeof(uint32_t)];
+        if (size < HeaderSize) {
+            if (error)
+                *error = "Truncated symbol name suffixes";
+            return false;
+        }
+        memcpy(header, pointer, HeaderSize);
+        if (header[0] != Magic || header[1] != Version) {
+            if (error)
+                *error = String::format<64>("Wrong symbol name suffixes version %u, expected %u",
+                                            header[0] == Magic ? header[1] : 0, Version);
+            return false;
+        }
+        if (HeaderSize + (header[2] * sizeof(SymbolNameSuffix)) > size) {
+            if (error)
+                *error = "Truncated symbol name suffixes";
+            return false;
+        }
+        mPointer = pointer;
+        mCount = header[2];
+        mOwner = owner;
+        return true;
+    }
+
+    uint32_t count() const { return mCount; }
+
+    SymbolNameSuffix at(uint32_t index) const
+    {
+        assert(index < mCount);
+        SymbolNameSuffix ret;
+        memcpy(&ret, mPointer + HeaderSize + (index * sizeof(SymbolNameSuffix)), sizeof(ret));
+        return ret;
+    }
+
+    /*
+     * Spells the permutation at index into buffer, the returned view is only
+     * valid until buffer is modified.
+     */
+    FileMapString view(const FileMap<String, Set<Location> > &names, uint32_t index, String &buffer) const
+    {
+        const SymbolNameSuffix suffix = at(index);
+        FileMap<String, Set<Location> >::KeyCursor cursor;
+        const FileMapString name = names.keyView(suffix.name, cursor);
+        assert(suffix.prefix <= suffix.offset && suffix.offset <= name.size());
+        buffer.assign(name.data(), suffix.prefix);
+        buffer.append(name.data() + suffix.offset, name.size() - suffix.offset);
+        return FileMapString(buffer.constData(), buffer.size());
+    }
+
+    // returns count() if all the permutations are less than k
+    uint32_t lowerBound(const FileMap<String, Set<Location> > &names, const String &k) const
+    {
+        String buffer;
+        uint32_t lower = 0, upper = mCount;
+        while (lower < upper) {
+            const uint32_t mid = lower + ((upper - lower) / 2);
+            if (view(names, mid, buffer).compare(k) < 0) {
+                lower = mid + 1;
+            } else {
+                upper = mid;
+            }
+        }
+        return lower;
+    }
+
+    // suffixes must be sorted by the permutation they spell
+    static String encode(const List<SymbolNameSuffix> &suffixes)
+    {
+        String out;
+        const uint32_t header[] = { Magic, Version, static_cast<uint32_t>(suffixes.size()) };
+        out.reserve(HeaderSize + (suffixes.size() * sizeof(SymbolNameSuffix)));
+        out.append(reinterpret_cast<const char *>(header), HeaderSize);
+        if (!suffixes.isEmpty())
+            out.append(reinterpret_cast<const char *>(&suffixes[0]), suffixes.size() * sizeof(SymbolNameSuffix));
+        return out;
+    }
+private:
+    const char *mPointer;
+    uint32_t mCount;
+    std::shared_ptr<void> mOwner;
+};
+
+#endif
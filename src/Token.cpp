@@ -1,6 +1,18 @@
 #include "Token.h"
 
 String Token::toString() const
+{
+    String ret;
+    {
+        Log log(&ret);
+        log << "Offset:" << offset
+            << "Length:" << length
+            << "Kind:" << kind;
+    }
+    return ret;
+}
+
+String Token::toString(Location location, const String &spelling) const
 {
     String ret;
     {
@@ -21,26 +21,48 @@
 #include "Location.h"
 #include <clang-c/Index.h>
 
+/*
+ * Tokens are stored as fixed size records in the tokens file map. The
+ * spelling isn't stored, it's the length bytes at offset in the file the
+ * token came from, see spelling().
+ */
 struct Token
 {
-    CXTokenKind kind;
-    String spelling;
-    Location location;
+    Token(CXTokenKind k = CXToken_Punctuation, uint32_t o = 0, uint32_t l = 0)
+        : offset(o), length(l), kind(k)
+    {}
+
     uint32_t offset, length;
+    CXTokenKind kind;
+
+    String spelling(const String &contents) const
+    {
+        if (offset + length > contents.size())
+            return String();
+        return contents.mid(offset, length);
+    }
 
     String toString() const;
+    String toString(Location location, const String &spelling) const;
 };
 
+template <> struct FixedSize<Token>
+{
+    static constexpr size_t value = sizeof(Token);
+};
+
+static_assert(sizeof(Token) == 12, "Token is stored as is in the tokens file map");
+
 template <> inline Serializer &operator<<(Serializer &s, const Token &t)
 {
-    s << static_cast<uint8_t>(t.kind) << t.spelling << t.location << t.offset << t.length;
+    s << static_cast<uint8_t>(t.kind) << t.offset << t.length;
     return s;
 }
 
 template <> inline Deserializer &operator>>(Deserializer &s, Token &t)
 {
     uint8_t kind;
-    s >> kind >> t.spelling >> t.location >> t.offset >> t.length;
+    s >> kind >> t.offset >> t.length;
     t.kind = static_cast<CXTokenKind>(kind);
     return s;
 }
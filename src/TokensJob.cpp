@@ -15,6 +15,8 @@
 
 #include "TokensJob.h"
 
+#include <algorithm>
+
 #include "Project.h"
 #include "QueryMessage.h"
 #include "rct/Log.h"
@@ -39,6 +41,30 @@ int TokensJob::execute()
     if (!map)
         return 2;
 
+    // the tokens don't store their spelling, read it from what was indexed
+    Path path = proj->sourceFilePath(mFileId, "unsaved");
+    if (!path.isFile()) {
+        path = Location::path(mFileId);
+        // the offsets are meaningless in a file that changed since
+        if (path.lastModifiedMs() > proj->fileMapsParseTime(mFileId)) {
+            write<256>("%s has been modified since it was indexed", path.constData());
+            return 3;
+        }
+    }
+    const String contents = path.readAll();
+    List<uint32_t> lines;
+    if (queryFlags() & QueryMessage::TokensIncludeSymbols || !(queryFlags() & QueryMessage::Elisp)) {
+        lines.append(0);
+        for (size_t pos = contents.indexOf('\n'); pos != String::npos; pos = contents.indexOf('\n', pos + 1))
+            lines.append(pos + 1);
+    }
+    auto location = [this, &lines](const Token &token) -> Location {
+        const auto it = std::upper_bound(lines.begin(), lines.end(), token.offset);
+        if (it == lines.begin())
+            return Location();
+        return Location(mFileId, it - lines.begin(), token.offset - *(it - 1) + 1);
+    };
+
     const uint32_t count = map->count();
     uint32_t i = 0;
     if (mFrom != 0) {
@@ -55,11 +81,11 @@ int TokensJob::execute()
         const char *elispFormat = "(cons %d (list (cons 'length %d) (cons 'kind \"%s\") (cons 'spelling \"%s\")))";
         write("(list");
         if (queryFlags() & QueryMessage::TokensIncludeSymbols) {
-            writeToken = [this, &proj, elispFormat](const Token &token) {
+            writeToken = [this, &proj, elispFormat, &contents, &location](const Token &token) {
                 String out = String::format<1024>(elispFormat,
                                                   token.offset, token.length, RTags::tokenKindSpelling(token.kind),
-                                                  RTags::elispEscape(token.spelling).constData());
-                const Symbol sym = proj->findSymbol(token.location);
+                                                  RTags::elispEscape(token.spelling(contents)).constData());
+                const Symbol sym = proj->findSymbol(location(token));
                 if (!sym.isNull()) {
                     out.chop(2);
                     out << " (cons 'symbol ";
@@ -73,15 +99,15 @@ int TokensJob::execute()
             };
 
         } else {
-            writeToken = [this, elispFormat](const Token &token) {
+            writeToken = [this, elispFormat, &contents](const Token &token) {
                 return write<1024>(elispFormat,
                                    token.offset, token.length, RTags::tokenKindSpelling(token.kind),
-                                   RTags::elispEscape(token.spelling).constData());
+                                   RTags::elispEscape(token.spelling(contents)).constData());
             };
         }
     } else {
-        writeToken = [this](const Token &token) {
-            return write(token.toString());
+        writeToken = [this, &contents, &location](const Token &token) {
+            return write(token.toString(location(token), token.spelling(contents)));
         };
     }
 
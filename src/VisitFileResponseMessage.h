@@ -24,18 +24,29 @@ public:
     enum { MessageId = VisitFileResponseId };
 
     VisitFileResponseMessage(uint32_t fileId = 0, bool visit = false)
-        : RTagsMessage(MessageId), mFileId(fileId), mVisit(visit)
+        : RTagsMessage(MessageId), mFileId(fileId), mVisit(visit), mFileMapGeneration(0)
     {
     }
 
     uint32_t fileId() const { return mFileId; }
     bool visit() const { return mVisit; }
 
-    void encode(Serializer &serializer) const { serializer << mFileId << mVisit; }
-    void decode(Deserializer &deserializer) { deserializer >> mFileId >> mVisit; }
+    // the file maps rdm currently has for the file, see FileMapContainer::digest()
+    uint32_t fileMapGeneration() const { return mFileMapGeneration; }
+    const String &fileMapsDigest() const { return mFileMapsDigest; }
+    void setFileMaps(uint32_t generation, const String &digest)
+    {
+        mFileMapGeneration = generation;
+        mFileMapsDigest = digest;
+    }
+
+    void encode(Serializer &serializer) const { serializer << mFileId << mVisit << mFileMapGeneration << mFileMapsDigest; }
+    void decode(Deserializer &deserializer) { deserializer >> mFileId >> mVisit >> mFileMapGeneration >> mFileMapsDigest; }
 private:
     uint32_t mFileId;
     bool mVisit;
+    uint32_t mFileMapGeneration;
+    String mFileMapsDigest;
 };
 
 #endif
@@ -78,7 +78,7 @@ static void signalHandler(int signal)
 #define DEFAULT_EXCLUDEFILTER "*/CMakeFiles/*;*/cmake*/Modules/*;*/conftest.c*;/tmp/*;/private/tmp/*;/private/var/*"
 #define DEFAULT_COMPILER_WRAPPERS "ccache"
 #define DEFAULT_RP_VISITFILE_TIMEOUT 60000
-#define DEFAULT_RDM_MAX_FILE_MAP_CACHE_SIZE 500
+#define DEFAULT_RDM_MAX_FILE_MAP_CACHE_SIZE 256
 #define DEFAULT_RP_INDEXER_MESSAGE_TIMEOUT 60000
 #define DEFAULT_RP_CONNECT_TIMEOUT 0 // won't time out
 #define DEFAULT_RP_CONNECT_ATTEMPTS 3
@@ -180,6 +180,7 @@ enum OptionType {
     EnableNDEBUG,
     Progress,
     MaxFileMapCacheSize,
+    FileMapCacheSize,
 #ifdef FILEMANAGER_OPT_IN
     FileManagerWatch,
 #else
@@ -208,6 +209,7 @@ enum OptionType {
     PollTimer,
     NoRealPath,
     TranslationUnitCache,
+    PackFileMaps,
     Noop
 };
 
@@ -240,7 +242,7 @@ int main(int argc, char** argv)
     serverOpts.rpIndexDataMessageTimeout = DEFAULT_RP_INDEXER_MESSAGE_TIMEOUT;
     serverOpts.rpConnectTimeout = DEFAULT_RP_CONNECT_TIMEOUT;
     serverOpts.rpConnectAttempts = DEFAULT_RP_CONNECT_ATTEMPTS;
-    serverOpts.maxFileMapScopeCacheSize = DEFAULT_RDM_MAX_FILE_MAP_CACHE_SIZE;
+    serverOpts.fileMapCacheSize = DEFAULT_RDM_MAX_FILE_MAP_CACHE_SIZE * 1024 * 1024;
     serverOpts.errorLimit = DEFAULT_ERROR_LIMIT;
     serverOpts.rpNiceValue = INT_MIN;
     serverOpts.options = Server::Wall|Server::SpellChecking;
@@ -328,14 +330,15 @@ int main(int argc, char** argv)
         { EnableCompilerManager, "enable-compiler-manager", 'R', CommandLineParser::NoValue, "Query compilers for their actual include paths instead of letting clang use its own." },
         { EnableNDEBUG, "enable-NDEBUG", 'g', CommandLineParser::NoValue, "Don't remove -DNDEBUG from compile lines." },
         { Progress, "progress", 'p', CommandLineParser::NoValue, "Report compilation progress in diagnostics output." },
-        { MaxFileMapCacheSize, "max-file-map-cache-size", 'y', CommandLineParser::Required, "Max files to cache per query (Should not exceed maximum number of open file descriptors allowed per process) (default " STR(DEFAULT_RDM_MAX_FILE_MAP_CACHE_SIZE) ")." },
+        { MaxFileMapCacheSize, "max-file-map-cache-size", 'y', CommandLineParser::Required, "Deprecated, file maps are cached by size now, see --file-map-cache-size." },
+        { FileMapCacheSize, "file-map-cache-size", 0, CommandLineParser::Required, "Max size in MB of mapped file maps to keep around between queries (default " STR(DEFAULT_RDM_MAX_FILE_MAP_CACHE_SIZE) ")." },
 #ifdef FILEMANAGER_OPT_IN
         { FileManagerWatch, "filemanager-watch", 'M', CommandLineParser::NoValue, "Use a file system watcher for filemanager." },
 #else
         { NoFileManagerWatch, "no-filemanager-watch", 'M', CommandLineParser::NoValue, "Don't use a file system watcher for filemanager." },
 #endif
         { NoFileManager, "no-filemanager", 0, CommandLineParser::NoValue, "Don't scan project directory for files. (rc -P won't work)." },
-        { NoFileLock, "no-file-lock", 0, CommandLineParser::NoValue, "Disable file locking. Not entirely safe but might improve performance on certain systems." },
+        { NoFileLock, "no-file-lock", 0, CommandLineParser::NoValue, "Deprecated, file maps are never locked." },
         { PchEnabled, "pch-enabled", 0, CommandLineParser::NoValue, "Enable PCH (experimental)." },
         { NoFilesystemWatcher, "no-filesystem-watcher", 'B', CommandLineParser::NoValue, "Disable file system watching altogether. Reindexing has to be triggered manually." },
         { ArgTransform, "arg-transform", 'V', CommandLineParser::Required, "Use arg to transform arguments. [arg] should be executable with (execv(3))." },
@@ -357,6 +360,7 @@ int main(int argc, char** argv)
         { PollTimer, "poll-timer", 0, CommandLineParser::Required, "Poll the database of the current project every <arg> seconds. " },
         { NoRealPath, "no-realpath", 0, CommandLineParser::NoValue, "Don't use realpath(3) for files" },
         { TranslationUnitCache, "translation-unit-cache", 0, CommandLineParser::NoValue, "Cache translation units. Not working yet." },
+        { PackFileMaps, "pack-file-maps", 0, CommandLineParser::NoValue, "Store file maps in a few large per-project segment files instead of one file per indexed file." },
         { Noop, "config", 'c', CommandLineParser::Required, "Use this file (instead of ~/.rdmrc)." },
         { Noop, "no-rc", 'N', CommandLineParser::NoValue, "Don't load any rc files." }
     };
@@ -598,10 +602,19 @@ int main(int argc, char** argv)
             serverOpts.options |= Server::Progress;
             break; }
         case MaxFileMapCacheSize: {
-            serverOpts.maxFileMapScopeCacheSize = atoi(value.constData());
-            if (serverOpts.maxFileMapScopeCacheSize <= 0) {
+            // this used to be a number of files, a count can't be turned
+            // into a size so keep the default rather than guess
+            if (atoi(value.constData()) <= 0) {
                 return { String::format<1024>("Invalid argument to -y %s", value.constData()), CommandLineParser::Parse_Error };
             }
+            fprintf(stderr, "-y/--max-file-map-cache-size is deprecated and ignored, use --file-map-cache-size [MB]\n");
+            break; }
+        case FileMapCacheSize: {
+            const int megabytes = atoi(value.constData());
+            if (megabytes <= 0) {
+                return { String::format<1024>("Invalid argument to --file-map-cache-size %s", value.constData()), CommandLineParser::Parse_Error };
+            }
+            serverOpts.fileMapCacheSize = static_cast<size_t>(megabytes) * 1024 * 1024;
             break; }
 #ifdef FILEMANAGER_OPT_IN
         case FileManagerWatch: {
@@ -616,7 +629,6 @@ int main(int argc, char** argv)
             serverOpts.options |= Server::NoFileManager;
             break; }
         case NoFileLock: {
-            serverOpts.options |= Server::NoFileLock;
             break; }
         case PchEnabled: {
             serverOpts.options |= Server::PCHEnabled;
@@ -714,6 +726,9 @@ int main(int argc, char** argv)
         case TranslationUnitCache: {
             serverOpts.options |= Server::TranslationUnitCache;
             break; }
+        case PackFileMaps: {
+            serverOpts.options |= Server::PackFileMaps;
+            break; }
         }
 
         return { String(), CommandLineParser::Parse_Exec };
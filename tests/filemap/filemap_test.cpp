@@ -0,0 +1,226 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Encodes maps in each of the FileMap layouts and reads them back: the
+ * search index of fixed size keys, front coded string keys and the columns
+ * of the symbols map. Sizes straddle the block sizes of the layouts.
+ */
+
+#include <stdio.h>
+#include <limits>
+#include <memory>
+
+#include "FileMap.h"
+#include "Location.h"
+#include "Symbol.h"
+#include "rct/List.h"
+#include "rct/Map.h"
+#include "rct/Set.h"
+#include "rct/String.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                \
+    do {                                                                \
+        if (!(condition)) {                                             \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                 \
+        }                                                               \
+    } while (0)
+
+static const uint32_t NotFound = std::numeric_limits<uint32_t>::max();
+static const uint32_t counts[] = { 0, 1, 15, 16, 17, 31, 32, 33, 100, 1000, 4097 };
+
+static void testSearchIndex()
+{
+    for (uint32_t count : counts) {
+        // every third key so that there are missing keys on both sides of each one
+        Map<uint64_t, uint32_t> map;
+        for (uint32_t i=0; i<count; ++i)
+            map[(static_cast<uint64_t>(i) * 3) + 1] = i;
+        const String data = FileMap<uint64_t, uint32_t>::encode(map);
+        FileMap<uint64_t, uint32_t> fileMap;
+        CHECK(fileMap.init(data.constData(), data.size()));
+        CHECK(fileMap.count() == count);
+
+        bool match;
+        for (uint32_t i=0; i<count; ++i) {
+            const uint64_t key = (static_cast<uint64_t>(i) * 3) + 1;
+            CHECK(fileMap.keyAt(i) == key);
+            CHECK(fileMap.value(key, &match) == i && match);
+            CHECK(fileMap.lowerBound(key - 1, &match) == i && !match);
+            CHECK(fileMap.lowerBound(key + 1, &match) == (i + 1 == count ? NotFound : i + 1) && !match);
+        }
+        CHECK(fileMap.lowerBound(std::numeric_limits<uint64_t>::max(), &match) == NotFound && !match);
+    }
+}
+
+static void testLocationKeys()
+{
+    // Location keys are searched on their sort key, file first
+    Map<Location, uint32_t> map;
+    uint32_t idx = 0;
+    for (uint32_t file=1; file<=3; ++file) {
+        for (uint32_t line=1; line<=40; ++line)
+            map[Location(file, line, (line % 7) + 1)] = idx++;
+    }
+    const String data = FileMap<Location, uint32_t>::encode(map);
+    FileMap<Location, uint32_t> fileMap;
+    CHECK(fileMap.init(data.constData(), data.size()));
+    CHECK(fileMap.count() == map.size());
+    bool match;
+    for (const auto &it : map) {
+        CHECK(fileMap.value(it.first, &match) == it.second && match);
+        CHECK(fileMap.keyAt(it.second) == it.first);
+    }
+    CHECK(fileMap.lowerBound(Location(2, 1, 100), &match) == 41 && !match);
+    CHECK(fileMap.lowerBound(Location(4, 1, 1), &match) == NotFound && !match);
+}
+
+static void testFrontCoding()
+{
+    // long shared prefixes need more than one byte for their length
+    const String longPrefix(300, 'x');
+    for (uint32_t count : counts) {
+        Map<String, Set<Location> > map;
+        for (uint32_t i=0; i<count; ++i) {
+            String key;
+            if (i % 5 == 0) {
+                key = longPrefix + String::format<32>("%u", i);
+            } else {
+                key = String::format<64>("ns::Class%u::method%u(int)", i / 10, i);
+            }
+            map[key].insert(Location(1, i + 1, 1));
+            map[key].insert(Location(2, i + 1, 5));
+        }
+        if (count)
+            map[String()].insert(Location(3, 1, 1));
+
+        const String data = FileMap<String, Set<Location> >::encode(map);
+        FileMap<String, Set<Location> > fileMap;
+        CHECK(fileMap.init(data.constData(), data.size()));
+        CHECK(fileMap.count() == map.size());
+
+        FileMap<String, Set<Location> >::KeyCursor cursor;
+        List<String> keys;
+        bool match;
+        uint32_t i = 0;
+        for (const auto &it : map) {
+            CHECK(fileMap.keyAt(i) == it.first);
+            CHECK(fileMap.keyView(i, cursor) == it.first);
+            CHECK(fileMap.valueAt(i) == it.second);
+            CHECK(fileMap.value(it.first, &match) == it.second && match);
+            keys.append(it.first);
+            ++i;
+        }
+
+        // backwards, so the cursor has to restart for every key
+        FileMap<String, Set<Location> >::KeyCursor reverse;
+        for (i=map.size(); i>0; --i)
+            CHECK(fileMap.keyView(i - 1, reverse) == keys.at(i - 1));
+
+        for (i=0; i<keys.size(); ++i) {
+            String missing = keys.at(i);
+            missing.append('\x01');
+            const uint32_t expected = i + 1 == keys.size() ? NotFound : i + 1;
+            CHECK(fileMap.lowerBound(missing, &match) == expected && !match);
+        }
+        CHECK(fileMap.lowerBound("zzz", &match) == NotFound && !match);
+
+        if (!keys.isEmpty()) {
+            List<uint32_t> indexes(keys.size());
+            std::unique_ptr<bool[]> matches(new bool[keys.size()]);
+            fileMap.lowerBounds(keys.data(), keys.size(), indexes.data(), matches.get());
+            for (i=0; i<keys.size(); ++i)
+                CHECK(indexes.at(i) == i && matches[i]);
+        }
+    }
+}
+
+static void testColumns()
+{
+    Map<Location, Symbol> map;
+    for (uint32_t i=0; i<40; ++i) {
+        Symbol symbol;
+        symbol.location = Location(1, i + 1, 3);
+        symbol.symbolName = String::format<32>("Class::method%u()", i);
+        symbol.usr = String::format<32>("c:@S@Class@F@method%u#", i);
+        if (i % 3 == 0) {
+            symbol.baseClasses.append("c:@S@Base");
+            symbol.baseClasses.append("c:@S@Other");
+        }
+        symbol.typeName = "void ()";
+        symbol.briefComment = String::format<32>("Method %u", i);
+        symbol.symbolLength = 7 + (i / 10);
+        symbol.kind = CXCursor_CXXMethod;
+        symbol.type = CXType_FunctionProto;
+        symbol.linkage = CXLinkage_External;
+        symbol.flags = Symbol::VirtualMethod|Symbol::Definition;
+        symbol.startLine = i + 1;
+        symbol.endLine = i + 3;
+        symbol.startColumn = 3;
+        symbol.endColumn = 4;
+        map[symbol.location] = symbol;
+    }
+    const String data = FileMap<Location, Symbol>::encode(map);
+    FileMap<Location, Symbol> fileMap;
+    CHECK(fileMap.init(data.constData(), data.size()));
+    CHECK(fileMap.count() == map.size());
+
+    uint32_t i = 0;
+    for (const auto &it : map) {
+        const Symbol &expected = it.second;
+        const Symbol symbol = fileMap.valueAt(i);
+        CHECK(symbol.location == expected.location);
+        CHECK(symbol.symbolName == expected.symbolName);
+        CHECK(symbol.usr == expected.usr);
+        CHECK(symbol.baseClasses == expected.baseClasses);
+        CHECK(symbol.typeName == expected.typeName);
+        CHECK(symbol.briefComment == expected.briefComment);
+        CHECK(symbol.symbolLength == expected.symbolLength);
+        CHECK(symbol.kind == expected.kind);
+        CHECK(symbol.type == expected.type);
+        CHECK(symbol.linkage == expected.linkage);
+        CHECK(symbol.flags == expected.flags);
+        CHECK(symbol.startLine == expected.startLine && symbol.endLine == expected.endLine);
+        CHECK(symbol.startColumn == expected.startColumn && symbol.endColumn == expected.endColumn);
+
+        // only the columns asked for are read
+        const Symbol hot = fileMap.valueAt(i, Symbol::Hot);
+        CHECK(hot.location == expected.location);
+        CHECK(hot.kind == expected.kind && hot.flags == expected.flags);
+        CHECK(hot.symbolName.isEmpty() && hot.typeName.isEmpty());
+        const Symbol names = fileMap.valueAt(i, Symbol::Names);
+        CHECK(names.symbolName == expected.symbolName && names.usr == expected.usr);
+        CHECK(names.kind == CXCursor_FirstInvalid && names.briefComment.isEmpty());
+
+        CHECK(fileMap.value(it.first).usr == expected.usr);
+        ++i;
+    }
+}
+
+int main()
+{
+    testSearchIndex();
+    testLocationKeys();
+    testFrontCoding();
+    testColumns();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,305 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Inserts, replaces and removes the names of files in a SymbolNameIndex and
+ * checks every query against the names that should be live, both while the
+ * runs are scanned and after the compactions merged them and built their
+ * search tables, and after an encode/decode round trip.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits>
+#include <memory>
+#include <utility>
+
+#include "SymbolNameIndex.h"
+#include "rct/EventLoop.h"
+#include "rct/Hash.h"
+#include "rct/List.h"
+#include "rct/Map.h"
+#include "rct/Serializer.h"
+#include "rct/Set.h"
+#include "rct/String.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                \
+    do {                                                                \
+        if (!(condition)) {                                             \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                 \
+        }                                                               \
+    } while (0)
+
+typedef Set<std::pair<String, uint32_t> > Names;
+
+static const char *words[] = { "get", "Set", "symbol", "Name", "index", "run", "Merge", "file", "map", "x" };
+
+static String randomName()
+{
+    String name;
+    const int count = 1 + (rand() % 3);
+    for (int i=0; i<count; ++i) {
+        if (i)
+            name.append(rand() % 2 ? "::" : "_");
+        name.append(words[rand() % (sizeof(words) / sizeof(words[0]))]);
+    }
+    if (rand() % 4 == 0)
+        name.append(String::format<16>("%d", rand() % 100));
+    return name;
+}
+
+static String lower(const char *data, uint32_t size)
+{
+    String ret(data, size);
+    for (size_t i=0; i<ret.size(); ++i)
+        ret[i] = tolower(static_cast<unsigned char>(ret[i]));
+    return ret;
+}
+
+static String lower(const String &string) { return lower(string.constData(), string.size()); }
+
+// compactions finish on the event loop, wait until the runs stop changing
+static void drain(const SymbolNameIndex &index)
+{
+    size_t runs = index.runCount();
+    int idle = 0;
+    for (int i=0; i<1000 && idle<10; ++i) {
+        EventLoop::eventLoop()->exec(5);
+        if (index.runCount() == runs) {
+            ++idle;
+        } else {
+            runs = index.runCount();
+            idle = 0;
+        }
+    }
+}
+
+static void checkQueries(const SymbolNameIndex &index, const Names &live)
+{
+    Names all;
+    bool duplicates = false;
+    index.find(String(), [&](const FileMapString &name, uint32_t fileId) {
+            duplicates |= !all.insert(std::make_pair(name.toString(), fileId));
+            return 1;
+        });
+    CHECK(!duplicates);
+    CHECK(all == live);
+
+    // prefixes, the visitor stops each run at the first name past the prefix
+    for (const char *prefix : { "get", "Merge::", "x_", "zzz" }) {
+        Names expected, found;
+        for (const auto &name : live) {
+            if (name.first.startsWith(prefix))
+                expected.insert(name);
+        }
+        index.find(prefix, [&](const FileMapString &name, uint32_t fileId) {
+                if (!name.startsWith(prefix))
+                    return -1;
+                found.insert(std::make_pair(name.toString(), fileId));
+                return 1;
+            });
+        CHECK(found == expected);
+    }
+
+    for (const char *prefix : { "SET", "name_", "M" }) {
+        const String folded = lower(prefix, strlen(prefix));
+        Names expected, found;
+        for (const auto &name : live) {
+            if (lower(name.first).startsWith(folded))
+                expected.insert(name);
+        }
+        index.findCaseInsensitive(prefix, [&](const FileMapString &name, uint32_t fileId) {
+                if (!name.startsWith(prefix, String::CaseInsensitive))
+                    return -1;
+                found.insert(std::make_pair(name.toString(), fileId));
+                return 1;
+            });
+        CHECK(found == expected);
+    }
+
+    // the candidates may contain names that don't match but not miss any
+    for (const List<String> &substrings : { List<String>({ "bol" }), List<String>({ "ame", "dex" }), List<String>({ "x" }) }) {
+        Names expected, found;
+        for (const auto &name : live) {
+            const String folded = lower(name.first);
+            bool match = true;
+            for (const String &substring : substrings)
+                match = match && folded.contains(lower(substring));
+            if (match)
+                expected.insert(name);
+        }
+        index.findSubstrings(substrings, [&](const FileMapString &name, uint32_t fileId) {
+                const String folded = lower(name.data(), name.size());
+                for (const String &substring : substrings) {
+                    if (!folded.contains(lower(substring)))
+                        return 0;
+                }
+                found.insert(std::make_pair(name.toString(), fileId));
+                return 1;
+            });
+        CHECK(found == expected);
+    }
+
+    // shortest names first
+    for (const char *characters : { "gsn", "mx", "9" }) {
+        const uint64_t mask = SymbolNameIndex::characters(characters, strlen(characters));
+        Names expected, found;
+        for (const auto &name : live) {
+            const uint64_t nameMask = SymbolNameIndex::characters(name.first.constData(), name.first.size());
+            if ((nameMask & mask) == mask)
+                expected.insert(name);
+        }
+        bool ordered = true;
+        uint32_t lastSize = 0;
+        index.findBySize(mask, [&](const FileMapString &name, uint32_t fileId) {
+                ordered = ordered && name.size() >= lastSize;
+                lastSize = name.size();
+                if ((SymbolNameIndex::characters(name.data(), name.size()) & mask) == mask)
+                    found.insert(std::make_pair(name.toString(), fileId));
+                return 0;
+            });
+        CHECK(ordered);
+        CHECK(found == expected);
+    }
+}
+
+static void checkRoundTrip(const SymbolNameIndex &index, const Names &live)
+{
+    String data;
+    {
+        Serializer serializer(data);
+        index.encode(serializer);
+    }
+    auto decoded = std::make_shared<SymbolNameIndex>();
+    Deserializer deserializer(data.constData(), data.size());
+    CHECK(decoded->decode(deserializer, data.size()));
+    CHECK(decoded->runCount() == index.runCount());
+    CHECK(decoded->fileCount() == index.fileCount());
+    checkQueries(*decoded, live);
+    // restored runs get their search tables in the background
+    drain(*decoded);
+    checkQueries(*decoded, live);
+
+    // damaged files fail instead of restoring names past the end of a run
+    for (size_t size : { static_cast<size_t>(0), static_cast<size_t>(10), data.size() / 2, data.size() - 1 }) {
+        auto truncated = std::make_shared<SymbolNameIndex>();
+        Deserializer partial(data.constData(), size);
+        CHECK(!truncated->decode(partial, size));
+        CHECK(!truncated->runCount() && !truncated->fileCount());
+    }
+}
+
+static void checkDamagedEntry()
+{
+    auto index = std::make_shared<SymbolNameIndex>();
+    Hash<uint32_t, List<String> > files;
+    files[1].append("getName");
+    index->insert(files);
+    String data;
+    {
+        Serializer serializer(data);
+        index->encode(serializer);
+    }
+    // the size of the only entry, which is written last, runs past the names
+    const uint32_t size = std::numeric_limits<uint32_t>::max();
+    memcpy(data.data() + data.size() - (sizeof(uint32_t) * 2), &size, sizeof(size));
+    auto decoded = std::make_shared<SymbolNameIndex>();
+    Deserializer deserializer(data.constData(), data.size());
+    CHECK(!decoded->decode(deserializer, data.size()));
+    CHECK(!decoded->runCount() && !decoded->fileCount());
+}
+
+int main()
+{
+    auto loop = std::make_shared<EventLoop>();
+    loop->init(EventLoop::MainEventLoop);
+
+    srand(1);
+    auto index = std::make_shared<SymbolNameIndex>();
+    // fileId -> names
+    Map<uint32_t, Set<String> > truth;
+    auto live = [&truth]() {
+        Names ret;
+        for (const auto &file : truth) {
+            for (const String &name : file.second)
+                ret.insert(std::make_pair(name, file.first));
+        }
+        return ret;
+    };
+
+    // batches pile up as runs while nothing merges them
+    const int batches = 40;
+    for (int batch=0; batch<batches; ++batch) {
+        Hash<uint32_t, List<String> > files;
+        const int fileCount = 1 + (rand() % 4);
+        for (int i=0; i<fileCount; ++i) {
+            const uint32_t fileId = 1 + (rand() % 60);
+            Set<String> &names = truth[fileId];
+            names.clear();
+            List<String> &list = files[fileId];
+            list.clear();
+            const int nameCount = rand() % 30;
+            for (int j=0; j<nameCount; ++j) {
+                const String name = randomName();
+                names.insert(name);
+                list.append(name);
+            }
+        }
+        index->insert(files);
+        if (batch % 7 == 0) {
+            const uint32_t fileId = 1 + (rand() % 60);
+            index->remove(fileId);
+            truth.remove(fileId);
+        }
+    }
+    CHECK(index->fileCount() == truth.size());
+    checkQueries(*index, live());
+
+    drain(*index);
+    CHECK(index->runCount() <= SymbolNameIndex::MaxRuns);
+    CHECK(index->runCount() < static_cast<size_t>(batches));
+    checkQueries(*index, live());
+
+    // removed names are gone before a compaction drops them
+    while (truth.size() > 10) {
+        const uint32_t fileId = truth.begin()->first;
+        index->remove(fileId);
+        truth.remove(fileId);
+        CHECK(!index->contains(fileId));
+    }
+    CHECK(index->fileCount() == truth.size());
+    checkQueries(*index, live());
+    drain(*index);
+    checkQueries(*index, live());
+
+    checkRoundTrip(*index, live());
+    checkDamagedEntry();
+
+    index->clear();
+    truth.clear();
+    CHECK(!index->runCount() && !index->fileCount());
+    checkQueries(*index, live());
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}